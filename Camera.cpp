@@ -11,7 +11,7 @@
 
 namespace RayTracerxx {
 
-Camera::Camera() {
+Camera::Camera() : pixel_AspectRatio(1), FOV(90) {
         screen = NULL;
         setPosition(0, 0, 0);
         setResolution(240, 135);
@@ -68,10 +68,9 @@ Number_t Camera::getPixelRatio() { return pixel_AspectRatio; }
  *
  * @return     The ray.
  */
-Ray Camera::getRay(unsigned col, unsigned row) {
+Ray Camera::getRay(unsigned col, unsigned row) const {
         if (not pixelInRange(col, row))
                 throw std::runtime_error("Error: Pixel not in range\n");
-        setScreenDistance();
         Number_t pixelCenter[3] = {0, 0, 0}, origin[3];
         Number_t p_Width = pixel_AspectRatio;  // ratio of pixel width to
                                                // height
@@ -151,14 +150,19 @@ void Camera::setFOV(int inDegrees) {
 
 /**
  * @details    Solves equation for screen distance to guarantee FOV is as
- *             specified
+ *             specified. Called by every setter the distance depends on so
+ *             that getRay never writes to the camera (it runs on many
+ *             threads at once while rendering)
  */
 void Camera::setScreenDistance() {
         screen_distance = (((Number_t)resolution[W] * pixel_AspectRatio) / 2);
         screen_distance /= tan(radians(FOV / 2));
 }
 
-void Camera::setPixelAspectRatio(Number_t ar) { pixel_AspectRatio = ar; }
+void Camera::setPixelAspectRatio(Number_t ar) {
+        pixel_AspectRatio = ar;
+        setScreenDistance();
+}
 
 /**
  * @brief      Sets the resolution.
@@ -181,6 +185,7 @@ void Camera::setResolution(int width, int height) {
                 delete[] screen;
 
         screen = new RGB[width * height];
+        setScreenDistance();
 }
 
 void Camera::setScale(Number_t newScale) {
@@ -193,7 +198,7 @@ void Camera::setPosition(Number_t x, Number_t y, Number_t z) {
         position          = Point<3>(toAdd);
 }
 
-bool Camera::pixelInRange(int col, int row) {
+bool Camera::pixelInRange(int col, int row) const {
         if (row < 0 or row >= resolution[H])
                 return false;
         if (col < 0 or col >= resolution[W])
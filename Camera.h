@@ -39,12 +39,15 @@ public:
         /**
          * @brief      Gets the ray passing throw the requested pixel.
          *
+         * @details    Does not modify the camera, so it is safe to call
+         *             from several render threads at once
+         *
          * @param[in]  row   The row
          * @param[in]  col   The col
          *
          * @return     The ray.
          */
-        Ray getRay(unsigned col, unsigned row);
+        Ray getRay(unsigned col, unsigned row) const;
 
         /**
          * @brief      Returns the vertical component of the screen's
@@ -172,7 +175,7 @@ private:
          * @return     True if indices are in range,
          *             False otherwise
          */
-        bool pixelInRange(int col, int row);
+        bool pixelInRange(int col, int row) const;
         // void rotate(Number_t point[], Number_t angle[]);
 
         /**
@@ -11,9 +11,12 @@
 
 #include "ImageEngine.h"
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include "ThreadPool.h"
+#include "Trace.h"
 
 namespace RayTracerxx {
 
@@ -26,34 +29,142 @@ ImageEngine::~ImageEngine() {
 }
 
 //
-// reads in a ppm file into Image
+// Parses the numbers of a .ppm file held in memory. Header numbers may be
+// separated by whitespace and comments, color numbers only by whitespace
 //
-void ImageEngine::readImage(std::string filename) {
-        std::ifstream inputFile;
+namespace {
+class PpmParser {
+public:
+        PpmParser(const char* begin, const char* end) : p(begin), end(end) {}
+
+        // reads a number of the header, false if there is none
+        bool header(int& value) {
+                while (p < end and (isSpace(*p) or *p == '#')) {
+                        if (*p == '#')
+                                while (p < end and *p != '\n')
+                                        p++;
+                        else
+                                p++;
+                }
+                return number(value);
+        }
+
+        // reads a number of a P3 color, false if there is none
+        bool color(int& value) {
+                while (p < end and isSpace(*p))
+                        p++;
+                return number(value);
+        }
+
+        // skips the single whitespace that ends a P6 header, returns the
+        // position of the binary colors
+        const char* binary() { return p < end ? p + 1 : end; }
+
+private:
+        static bool isSpace(char c) {
+                return c == ' ' or c == '\n' or c == '\r' or c == '\t' or
+                       c == '\v' or c == '\f';
+        }
+
+        bool number(int& value) {
+                if (p == end or *p < '0' or *p > '9')
+                        return false;
+                value = 0;
+                for (; p < end and *p >= '0' and *p <= '9'; p++) {
+                        value = value * 10 + (*p - '0');
+                        if (value > 1 << 24)
+                                return false;
+                }
+                return true;
+        }
 
-        inputFile.open(filename.c_str());
+        const char* p;
+        const char* end;
+};
+}  // namespace
+
+//
+// reads in a ppm file into Image. The whole file is read at once and
+// parsed by hand: operator>> is far too slow for large images
+//
+bool ImageEngine::readImage(std::string filename) {
+        TraceScope    trace("decode");
+        std::ifstream inputFile(filename.c_str(), std::ios::binary);
         if (not inputFile.is_open()) {
-                std::cerr << "Unable to open file.\n";
-                exit(1);
+                std::cerr << "Unable to open file: " << filename << "\n";
+                return false;
+        }
+        inputFile.seekg(0, std::ios::end);
+        std::vector<char> data(std::max<std::streamoff>(inputFile.tellg(), 0));
+        inputFile.seekg(0, std::ios::beg);
+        inputFile.read(data.data(), data.size());
+
+        if (data.size() < 2 or data[0] != 'P' or
+            (data[1] != '3' and data[1] != '6')) {
+                std::cerr << filename << " is not a P3 or P6 image\n";
+                return false;
         }
-        image.colors.clear();
-        inputFile >> image.magic_number;
-        inputFile >> image.width;
-        inputFile >> image.height;
-        inputFile >> image.max_color;
-        std::cout << image.width << "," << image.height << "\n";
-        // read in the colors
-        for (int r = 0; r < image.height; r++) {
-                std::vector<rgb> image_row;
-                for (int c = 0; c < image.width; c++) {
-                        rgb color;
-                        inputFile >> color.red;
-                        inputFile >> color.green;
-                        inputFile >> color.blue;
-                        image_row.push_back(color);
+
+        Image     read;
+        PpmParser parser(data.data() + 2, data.data() + data.size());
+        read.magic_number = std::string(data.data(), 2);
+        if (not parser.header(read.width) or not parser.header(read.height) or
+            not parser.header(read.max_color) or read.width <= 0 or
+            read.height <= 0 or read.max_color <= 0 or
+            read.max_color > 65535) {
+                std::cerr << filename << ": invalid header\n";
+                return false;
+        }
+
+        read.colors.resize(read.height);
+        bool ok = true;
+        if (read.magic_number == "P3") {
+                for (int r = 0; r < read.height and ok; r++) {
+                        read.colors[r].resize(read.width);
+                        for (rgb& c : read.colors[r])
+                                ok = ok and parser.color(c.red) and
+                                     parser.color(c.green) and
+                                     parser.color(c.blue);
                 }
-                image.colors.push_back(image_row);
+        } else {
+                // rows are independent in binary, decode them in parallel
+                size_t channel = read.max_color > 255 ? 2 : 1;
+                size_t rowSize = 3 * channel * read.width;
+                const unsigned char* colors =
+                    reinterpret_cast<const unsigned char*>(parser.binary());
+                const unsigned char* last = reinterpret_cast<
+                    const unsigned char*>(data.data() + data.size());
+
+                ok = size_t(last - colors) >= rowSize * read.height;
+                parallelFor(0, ok ? read.height : 0, 64, [&](size_t begin,
+                                                             size_t end) {
+                        for (size_t r = begin; r < end; r++) {
+                                const unsigned char* in = colors + r * rowSize;
+                                read.colors[r].resize(read.width);
+                                for (rgb& c : read.colors[r]) {
+                                        int* channels[3] = {&c.red, &c.green,
+                                                            &c.blue};
+                                        for (int* value : channels) {
+                                                *value = channel == 2
+                                                             ? in[0] << 8 | in[1]
+                                                             : in[0];
+                                                in += channel;
+                                        }
+                                }
+                        }
+                });
+        }
+        if (not ok) {
+                std::cerr << filename << ": missing or invalid colors\n";
+                return false;
         }
+
+        image.magic_number = read.magic_number;
+        image.width        = read.width;
+        image.height       = read.height;
+        image.max_color    = read.max_color;
+        image.colors.swap(read.colors);
+        return true;
 }
 
 void ImageEngine::newImage(int width, int height) {
@@ -63,29 +174,122 @@ void ImageEngine::newImage(int width, int height) {
         image.height       = height;
 }
 
+//
+// copies the camera screen into the image, one row per task
+//
 void ImageEngine::copyScreen(RGB* screen) {
-        int ind = -1;
         using std::max;
-        for (int y = 0; y < image.height; y++) {
-                std::vector<rgb> newRow;
-                for (int x = 0; x < image.width; x++) {
-                        ind = x + y * image.width;
-                        rgb newColor;
-
-                        newColor.blue  = screen[ind].blue();
-                        newColor.green = screen[ind].green();
-                        newColor.red   = screen[ind].red();
+        TraceScope       trace("copyScreen");
+        size_t           first = image.colors.size();
+        std::vector<int> rowMax(image.height, image.max_color);
+
+        image.colors.resize(first + image.height);
+        parallelFor(0, image.height, 16, [&](size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                        std::vector<rgb>& newRow = image.colors[first + y];
+                        newRow.resize(image.width);
+                        for (int x = 0; x < image.width; x++) {
+                                int  ind      = x + y * image.width;
+                                rgb& newColor = newRow[x];
+
+                                newColor.blue  = screen[ind].blue();
+                                newColor.green = screen[ind].green();
+                                newColor.red   = screen[ind].red();
+
+                                rowMax[y] = max(
+                                    newColor.green,
+                                    max(newColor.red,
+                                        max(newColor.blue, rowMax[y])));
+                        }
+                }
+        });
 
-                        image.max_color =
-                            max(newColor.green,
-                                max(newColor.red,
-                                    max(newColor.blue, image.max_color)));
+        for (int m : rowMax)
+                image.max_color = max(image.max_color, m);
+}
+//
+// maps values to colors along black, blue, cyan, green, yellow, red
+//
+void ImageEngine::copyHeatmap(const std::vector<uint32_t>& values,
+                              uint32_t                     maxValue) {
+        static const rgb stops[] = {{0, 0, 0},     {0, 0, 255}, {0, 255, 255},
+                                    {0, 255, 0},   {255, 255, 0},
+                                    {255, 0, 0}};
+        const int        segments = sizeof(stops) / sizeof(stops[0]) - 1;
+        size_t           first    = image.colors.size();
+
+        maxValue = std::max<uint32_t>(maxValue, 1);
+        image.colors.resize(first + image.height);
+        parallelFor(0, image.height, 16, [&](size_t begin, size_t end) {
+                for (size_t y = begin; y < end; y++) {
+                        std::vector<rgb>& newRow = image.colors[first + y];
+                        newRow.resize(image.width);
+                        for (int x = 0; x < image.width; x++) {
+                                double t = std::min<double>(
+                                    values[x + y * image.width], maxValue);
+                                t        = t * segments / maxValue;
+                                int    s = std::min<int>(t, segments - 1);
+                                double f = t - s;
+
+                                const rgb &a = stops[s], &b = stops[s + 1];
+                                newRow[x].red   = a.red + f * (b.red - a.red);
+                                newRow[x].green =
+                                    a.green + f * (b.green - a.green);
+                                newRow[x].blue = a.blue + f * (b.blue - a.blue);
+                        }
+                }
+        });
+}
 
-                        newRow.push_back(newColor);
+//
+// compares the channels of both images in levels of 0 to 255
+//
+bool ImageEngine::compare(const ImageEngine& other, ImageDiff& result,
+                          ImageEngine* diff, uint32_t heatMax) const {
+        const Image& a = image;
+        const Image& b = other.image;
+        if (a.width != b.width or a.height != b.height or
+            a.colors.size() != size_t(a.height) or
+            b.colors.size() != size_t(b.height))
+                return false;
+
+        double                scaleA = 255.0 / a.max_color;
+        double                scaleB = 255.0 / b.max_color;
+        double                squares = 0;
+        std::vector<uint32_t> heat(size_t(a.width) * a.height);
+        result = ImageDiff();
+        for (int y = 0; y < a.height; y++) {
+                for (int x = 0; x < a.width; x++) {
+                        const rgb& p = a.colors[y][x];
+                        const rgb& q = b.colors[y][x];
+                        double     e[3] = {p.red * scaleA - q.red * scaleB,
+                                       p.green * scaleA - q.green * scaleB,
+                                       p.blue * scaleA - q.blue * scaleB};
+                        double     worst = 0;
+                        for (double error : e) {
+                                squares += error * error;
+                                worst = std::max(worst, std::fabs(error));
+                        }
+                        if (worst > result.maxError) {
+                                result.maxError = worst;
+                                result.maxX     = x;
+                                result.maxY     = y;
+                        }
+                        result.differentPixels += worst >= 1;
+                        heat[x + y * a.width] = std::lround(worst);
                 }
-                image.colors.push_back(newRow);
         }
+
+        double mse  = squares / (3.0 * a.width * a.height);
+        result.psnr = mse > 0 ? 10 * std::log10(255 * 255 / mse) : INFINITY;
+        if (diff != NULL) {
+                diff->newImage(a.width, a.height);
+                diff->image.colors.clear();
+                diff->copyHeatmap(heat, heatMax);
+        }
+        return true;
 }
+
 //
 // copy current image's metadata to new image
 //
@@ -212,6 +416,7 @@ void ImageEngine::psychedelic() {
 // Save the current image into the named file.
 //
 void ImageEngine::save(std::string filename) {
+        TraceScope    trace("encode");
         std::ofstream outputfile;
 
         outputfile.open(filename.c_str());
@@ -223,17 +428,23 @@ void ImageEngine::save(std::string filename) {
         outputfile << image.magic_number << "\n";
         outputfile << image.width << " " << image.height << "\n";
         outputfile << image.max_color << "\n";
-        std::vector<std::vector<rgb> >::iterator r;
-        std::vector<rgb>::iterator               c;
-
-        for (r = image.colors.begin(); r != image.colors.end(); ++r) {
-                for (c = r->begin(); c < r->end(); ++c) {
-                        outputfile << c->red << " ";
-                        outputfile << c->green << " ";
-                        outputfile << c->blue << "  ";
+
+        // rows are formatted in parallel, then written in order
+        std::vector<std::string> rows(image.colors.size());
+        parallelFor(0, rows.size(), 16, [&](size_t begin, size_t end) {
+                for (size_t r = begin; r < end; r++) {
+                        std::string& text = rows[r];
+                        for (const rgb& c : image.colors[r]) {
+                                text += std::to_string(c.red) + " ";
+                                text += std::to_string(c.green) + " ";
+                                text += std::to_string(c.blue) + "  ";
+                        }
+                        text += "\n";
                 }
-                outputfile << "\n";
-        }
+        });
+
+        for (const std::string& text : rows)
+                outputfile << text;
         outputfile.close();
 }
 }  // namespace RayTracerxx
\ No newline at end of file
@@ -9,6 +9,8 @@
 #ifndef ImageEngine_H_
 #define ImageEngine_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "rgb.h"
@@ -28,8 +30,10 @@ struct rgb {
 // r1_0 g1_0 b1_0  r1_1 g1_1 b1_1  r1_2 g1_2 b1_2 ...
 // etc. until all rows have been defined
 //
-// .ppm files can also have comments, but this program does not
-// handle ppms with comments.
+// .ppm files can also have comments (# to the end of the line) in the
+// header. P6 files hold the same header followed by the colors in binary,
+// one byte per channel, or two (most significant first) when max_color is
+// above 255. Images are saved as P3.
 // See: http://en.wikipedia.org/wiki/Netpbm_format#PPM_example
 
 struct Image {
@@ -40,13 +44,25 @@ struct Image {
         std::vector<std::vector<rgb>> colors;     // the 2D array of colors
 };
 
+// differences between two images of the same size. Channels are compared
+// in levels of 0 to 255, scaling each image by its own max_color
+struct ImageDiff {
+        double psnr;             // in dB, infinite if the images are equal
+        double maxError;         // largest channel difference, in levels
+        int    maxX, maxY;       // a pixel with that difference
+        size_t differentPixels;  // pixels with a channel off by a level
+};
+
 class ImageEngine {
 public:
         ImageEngine();
         ~ImageEngine();
 
-        // reads in the .ppm file
-        void readImage(std::string filename);
+        // reads in a P3 or P6 .ppm file. On error, prints why to cerr,
+        // leaves the image unchanged and returns false
+        bool readImage(std::string filename);
+
+        const Image &getImage() const { return image; }
 
         // scales the image up by an integer factor, e.g., 2x or 3x
         void scale_up(int factor);
@@ -69,6 +85,18 @@ public:
         void newImage(int width, int height);
         void copyScreen(RGB *);
 
+        // fills the image with false colors, from black (0) through blue,
+        // cyan, green and yellow to red (maxValue and above)
+        void copyHeatmap(const std::vector<uint32_t> &values,
+                         uint32_t                     maxValue);
+
+        // compares with another image of the same size, returns false if
+        // the sizes differ. diff, if not NULL, receives a heatmap of the
+        // largest channel difference of every pixel, black where equal and
+        // red from heatMax levels
+        bool compare(const ImageEngine &other, ImageDiff &result,
+                     ImageEngine *diff = NULL, uint32_t heatMax = 16) const;
+
 private:
         // copies just the metadata for the image to another
         // image (not the color data)
@@ -1,67 +1,362 @@
 #include "KDTree2.h"
+#include <algorithm>
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <iterator>
 #include <limits>
+#include <numeric>
 #include <unordered_set>
 #include <vector>
 #include "Box.h"
+#include "Log.h"
 #include "OrderedList.h"
 #include "PolyObject.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "TraversalStats.h"
 #include "ray.h"
 namespace RayTracerxx {
 
-KDTree::KDTree(Box sceneBox, TriList triangles) {
+/**
+ * @brief      Tests a triangle of a leaf on its intersection record. The
+ *             Triangle itself is only looked up when it is closer than the
+ *             hit so far. Counts the test (and whether it found a closer
+ *             hit) in stats builds
+ */
+static inline void intersectTriangle(const TriAccel &acc, const Triangle *tri,
+                                     Ray &ray) {
+        STAT_COUNT(ray, tris);
+        if (acc.Intersect(ray)) {
+                ray.hit = tri;
+                STAT_COUNT(ray, hits);
+        }
+}
+
+KDTree::KDTree(Box sceneBox, TriList tris, BuildOptions opts)
+    : triangles(tris), options(opts) {
         bbox      = sceneBox;
-        num_nodes = 0;
-        root      = buildTree(triangles, sceneBox);
-        std::cout << "Num nodes " << num_nodes << "\n";
+        num_nodes  = 0;
+        num_events = 0;
+        buildTree(triangles, sceneBox);
+
+        // traversal tests these records, and only reads the Triangle of a hit
+        accel.resize(triangles.size());
+        parallelFor(0, triangles.size(), 1 << 14,
+                    [&](size_t first, size_t last) {
+                            for (size_t i = first; i < last; i++)
+                                    accel[i] = triangles[i]->accel();
+                    });
+        Log::out(Log::DETAIL) << "Num nodes " << num_nodes << "\n";
 }
 
-bool KDTree::Intersect(Ray &ray) {
+/**
+ * @brief      Walks the tree "in-order" with an explicit stack.
+ *
+ * @details    At each inner node, determines where the ray traverses the
+ *             area before and after the split plane. When it crosses both,
+ *             the far child is pushed and the near child is visited first.
+ *             A far child is only visited if no hit was found before the
+ *             ray reaches it; entries below it on the stack start even
+ *             further away, so the walk ends at the first such entry.
+ */
+bool KDTree::Intersect(Ray &ray) const {
         std::pair<Number_t, Number_t> t     = bbox.Intersect(ray);
         Number_t                      infty = Ray::Infinity;
 
-        if (t != std::make_pair(infty, infty))
-                root->traverse(ray, t.first, t.second);
+        if (t == std::make_pair(infty, infty))
+                return false;
+
+        StackEntry stack[maxDepth];
+        int        top   = 0;
+        uint32_t   index = 0;
+        Number_t   t_min = t.first, t_max = t.second;
+
+        while (true) {
+                const Node &node = nodes[index];
+
+                if (node.isLeaf()) {
+                        const uint32_t *tri =
+                            leafTris.data() + node.tris.first;
+                        STAT_COUNT(ray, leaves);
+                        for (uint32_t i = 0; i < node.tris.count; i++)
+                                intersectTriangle(accel[tri[i]],
+                                                  triangles[tri[i]], ray);
+
+                        if (top == 0)
+                                break;
+                        const StackEntry &next = stack[--top];
+                        // Stop if ray hits something before reaching far
+                        if (ray.t < next.t_min)
+                                break;
+                        index = next.node;
+                        t_min = next.t_min;
+                        t_max = next.t_max;
+                        continue;
+                }
+
+                // finds when ray intersects split plane
+                STAT_COUNT(ray, inner);
+                int      k       = node.axis();
+                Number_t t_split = (node.split - ray.origin[k]) * ray.inv(k);
+
+                // finds the child closest to ray origin. A ray starting on
+                // the plane belongs to the side it is heading to
+                bool leftFirst = ray.origin[k] < node.split or
+                                 (ray.origin[k] == node.split and ray.isNeg[k]);
+                uint32_t near = leftFirst ? index + 1 : node.rightChild();
+                uint32_t far  = leftFirst ? node.rightChild() : index + 1;
+
+                // only traverse near if ray exits before hitting far
+                if (t_split > t_max or t_split <= 0)
+                        index = near;
+                // only traverse far if ray exits before hitting near
+                else if (t_split < t_min)
+                        index = far;
+                else {
+                        // tries near, then goes far if no hit
+                        stack[top++] = {far, t_split, t_max};
+                        index        = near;
+                        t_max        = t_split;
+                }
+        }
 
         return not(ray.hit == NULL);
 }
 
+bool KDTree::Occluded(Ray &ray, Number_t tmax) const {
+        std::pair<Number_t, Number_t> t = bbox.Intersect(ray);
+
+        // Triangle::Intersect only records hits closer than ray.t
+        ray.hit = NULL;
+        ray.t   = tmax;
+
+        if (t.first > tmax)  // also covers a miss (t.first == Infinity)
+                return false;
+
+        StackEntry stack[maxDepth];
+        int        top   = 0;
+        uint32_t   index = 0;
+        Number_t   t_min = t.first, t_max = std::min(t.second, tmax);
+
+        while (true) {
+                const Node &node = nodes[index];
+
+                if (node.isLeaf()) {
+                        const uint32_t *tri =
+                            leafTris.data() + node.tris.first;
+                        STAT_COUNT(ray, leaves);
+                        for (uint32_t i = 0; i < node.tris.count; i++) {
+                                intersectTriangle(accel[tri[i]],
+                                                  triangles[tri[i]], ray);
+                                if (ray.hit != NULL)
+                                        return true;
+                        }
+
+                        if (top == 0)
+                                return false;
+                        const StackEntry &next = stack[--top];
+                        index                  = next.node;
+                        t_min                  = next.t_min;
+                        t_max                  = next.t_max;
+                        continue;
+                }
+
+                STAT_COUNT(ray, inner);
+                int      k       = node.axis();
+                Number_t t_split = (node.split - ray.origin[k]) * ray.inv(k);
+
+                bool leftFirst = ray.origin[k] < node.split or
+                                 (ray.origin[k] == node.split and ray.isNeg[k]);
+                uint32_t near = leftFirst ? index + 1 : node.rightChild();
+                uint32_t far  = leftFirst ? node.rightChild() : index + 1;
+
+                if (t_split > t_max or t_split <= 0)
+                        index = near;
+                else if (t_split < t_min)
+                        index = far;
+                else {
+                        stack[top++] = {far, t_split, t_max};
+                        index        = near;
+                        t_max        = t_split;
+                }
+        }
+}
+
+Number_t KDTree::sahCost() const {
+        return nodes.empty() ? 0 : sahCost(0, bbox);
+}
+
+Number_t KDTree::sahCost(uint32_t index, const Box &V) const {
+        const Node &node = nodes[index];
+        Number_t    P    = hit_prob(V, bbox);
+
+        if (node.isLeaf())
+                return P * ki * node.tris.count;
+
+        Box left_box, right_box;
+        splitBox(V, Plane(node.axis(), node.split), left_box, right_box);
+        return P * kt + sahCost(index + 1, left_box) +
+               sahCost(node.rightChild(), right_box);
+}
+
+KDTree::Report KDTree::report() const {
+        Report            r = Report();
+        std::vector<bool> seen(triangles.size(), false);
+
+        if (not nodes.empty())
+                report(0, 0, r, seen);
+
+        r.uniqueTris   = std::count(seen.begin(), seen.end(), true);
+        r.avgLeafDepth = r.numLeaves ? r.avgLeafDepth / r.numLeaves : 0;
+        r.duplication  = r.uniqueTris ? double(r.references) / r.uniqueTris
+                                      : 0;
+        r.sahCost      = sahCost();
+        r.nodeBytes    = nodes.capacity() * sizeof(Node);
+        r.leafBytes    = leafTris.capacity() * sizeof(uint32_t);
+        r.accelBytes   = accel.capacity() * sizeof(TriAccel);
+        r.buildEvents  = num_events;
+        return r;
+}
+
+void KDTree::report(uint32_t index, int d, Report &r,
+                    std::vector<bool> &seen) const {
+        const Node &node = nodes[index];
+        if (not node.isLeaf()) {
+                r.numInner++;
+                report(index + 1, d + 1, r, seen);
+                report(node.rightChild(), d + 1, r, seen);
+                return;
+        }
+
+        // bucket b > 0 holds counts in (2^(b - 2), 2^(b - 1)]
+        uint32_t count  = node.tris.count;
+        int      bucket = 0;
+        while (bucket < Report::histogramSize - 1 and
+               count > (bucket ? 1u << (bucket - 1) : 0u))
+                bucket++;
+
+        r.numLeaves++;
+        r.emptyLeaves += (count == 0);
+        r.leafHistogram[bucket]++;
+        r.maxLeafDepth = std::max(r.maxLeafDepth, d);
+        r.avgLeafDepth += d;  // divided by the number of leaves at the end
+        r.references += count;
+        for (uint32_t i = 0; i < count; i++)
+                seen[leafTris[node.tris.first + i]] = true;
+}
+
+void KDTree::Report::print(std::ostream &out) const {
+        const char *buckets[histogramSize] = {"0",     "1",     "2",
+                                              "3-4",   "5-8",   "9-16",
+                                              "17-32", "33-64", "65+"};
+
+        out << "Nodes: " << numInner + numLeaves << " (" << numInner
+            << " inner, " << numLeaves << " leaves, " << emptyLeaves
+            << " empty)\n";
+        out << "Leaf depth: max " << maxLeafDepth << ", average "
+            << avgLeafDepth << "\n";
+        out << "Triangles per leaf:\n";
+        for (int b = 0; b < histogramSize; b++)
+                out << "  " << buckets[b] << ": " << leafHistogram[b] << "\n";
+        out << "References: " << references << " for " << uniqueTris
+            << " triangles (duplication " << duplication << ")\n";
+        out << "SAH cost: " << sahCost << "\n";
+        out << "Memory: " << nodeBytes << " bytes of nodes, " << leafBytes
+            << " bytes of leaf lists, " << accelBytes
+            << " bytes of intersection records\n";
+        out << "Build events: " << buildEvents << "\n";
+}
+
+void KDTree::Report::printJSON(std::ostream &out) const {
+        out << "{\"nodes\": " << numInner + numLeaves
+            << ", \"inner\": " << numInner << ", \"leaves\": " << numLeaves
+            << ", \"empty_leaves\": " << emptyLeaves
+            << ", \"max_depth\": " << maxLeafDepth
+            << ", \"avg_depth\": " << avgLeafDepth
+            << ", \"leaf_histogram\": [";
+        for (int b = 0; b < histogramSize; b++)
+                out << (b ? ", " : "") << leafHistogram[b];
+        out << "], \"references\": " << references
+            << ", \"unique_triangles\": " << uniqueTris
+            << ", \"duplication\": " << duplication
+            << ", \"sah_cost\": " << sahCost
+            << ", \"node_bytes\": " << nodeBytes
+            << ", \"leaf_bytes\": " << leafBytes
+            << ", \"accel_bytes\": " << accelBytes
+            << ", \"build_events\": " << buildEvents << "}\n";
+}
+
+int KDTree::depth(uint32_t index, int d) const {
+        if (nodes[index].isLeaf())
+                return d;
+        return std::max(depth(index + 1, d + 1),
+                        depth(nodes[index].rightChild(), d + 1));
+}
+
 /**
  * @brief      Initializes the building process by generating lists of events
  *             and objects. Starts building KDTree.
  */
-KDTree::Node *KDTree::buildTree(TriList &tris, const Box &V) {
-        std::vector<Object> objPool;  // contiguous memory for all Object
-        ObjectList            objects;  // list of pointers to objPool
-        EventList             events;
-
-        objects.reserve(tris.size());
-        objPool.reserve(tris.size());
+void KDTree::buildTree(TriList &tris, const Box &V) {
+        TraceScope   trace("build kd-tree", "triangles", tris.size());
+        ObjectList   objects(tris.size());
+        EventList    events;
+        Subtree      tree;
+        BuildContext ctx;
 
         // Generate object list
-        for (Triangle *t : tris) {
-                objPool.emplace_back(t);
-                objects.push_back(&objPool.back());
+        std::iota(objects.begin(), objects.end(), 0);
+
+        // the binned build works on the objects only
+        if (options.bins > 0) {
+                buildTree(objects, events, V, 0, tree, ctx);
+                nodes.swap(tree.nodes);
+                leafTris.swap(tree.leafTris);
+                nodes.shrink_to_fit();
+                leafTris.shrink_to_fit();
+                return;
         }
 
         // std::cout << "objects.size() = " << objects.size() << "\n";
         // std::cout << "Events.size() = " << events.size() << "\n";
 
-        // Generate events for candidate planes (sides of bounding boxes)
-        for (Object *tmp : objects) {
-                for (unsigned k = X; k <= Z; k++) {
-                        Box bounds = clipTriangleToBox(tmp->tri, V);
-                        generateEvent(bounds, k, tmp, events);
+        // Generate events for candidate planes (sides of bounding boxes).
+        // Chunks are generated in parallel and concatenated in order, so the
+        // event list is the same as a serial pass would produce
+        constexpr size_t       grain     = 1 << 14;
+        size_t                 numChunks = (objects.size() + grain - 1) / grain;
+        std::vector<EventList> chunks(numChunks);
+        parallelFor(0, objects.size(), grain, [&](size_t first, size_t last) {
+                TraceScope trace("generate events", "first", first);
+                EventList &chunk = chunks[first / grain];
+                chunk.reserve(6 * (last - first));
+                for (size_t i = first; i < last; i++) {
+                        for (unsigned k = X; k <= Z; k++) {
+                                Box bounds = clipTriangleToBox(tris[i], V);
+                                generateEvent(bounds, k, i, chunk);
+                        }
                 }
-        }
+        });
+
+        events.reserve(6 * objects.size());
+        for (EventList &chunk : chunks)
+                events.insert(events.end(), chunk.begin(), chunk.end());
 
         // sort the events
-        std::sort(events.begin(), events.end());
+        {
+                TraceScope sorting("sort events", "events", events.size());
+                parallelSort(events, std::less<Event>());
+        }
         // std::cout << "Events.size() = " << events.size() << "\n";
 
-        return buildTree(objects, events, V);
+        buildTree(objects, events, V, 0, tree, ctx);
+
+        // the build over-allocates while appending, keep only what is used
+        nodes.swap(tree.nodes);
+        leafTris.swap(tree.leafTris);
+        nodes.shrink_to_fit();
+        leafTris.shrink_to_fit();
 }
 
 
@@ -69,35 +364,101 @@ KDTree::Node *KDTree::buildTree(TriList &tris, const Box &V) {
   * @brief      Tries to split current node into two smaller nodes if a good
   *             split can be found.
   */
-KDTree::Node *KDTree::buildTree(ObjectList &objs, EventList &events,
-                                const Box &V) {
+void KDTree::buildTree(const ObjectList &objs, const EventList &events,
+                       const Box &V, int depth, Subtree &out,
+                       BuildContext &ctx) {
         Plane              sp(-1, std::numeric_limits<Number_t>::max());
         constexpr unsigned minTris = 5;
         num_nodes++;
-
-        // Make leaf if good split isn't possible, or there are few triangles
-        if (objs.size() < minTris || !findSplit(objs.size(), V, events, sp))
-                return new LeafNode(objs, V);
-
-        EventList EL, ER; // left and right event lists for children
-        generateChildList(events, sp, V, EL, ER);
+        num_events += events.size();
+
+        TraceScope trace(objs.size() >= traceThreshold ? "buildTree" : NULL,
+                         "objects", objs.size());
+
+        // Make leaf if good split isn't possible, there are few triangles, or
+        // the traversal stack could not hold a deeper path
+        if (objs.size() < minTris || depth >= maxDepth - 1)
+                return makeLeaf(objs, out);
+        if (options.bins > 0 ? !findBinnedSplit(objs, V, ctx, sp)
+                             : !findSplit(objs.size(), V, events, sp))
+                return makeLeaf(objs, out);
+
+        // split the events and objs into lists for left and right. The
+        // children are built from (and overwrite) the next level's buffers
+        BuildLevel &children = ctx.levels[depth + 1];
+        if (options.bins > 0)
+                generateBinnedChildList(objs, sp, ctx, children);
+        else
+                generateChildList(events, sp, V, objs, ctx, children);
 
         Box left_box, right_box;
         splitBox(V, sp, left_box, right_box);
 
-        // split the objs into lists for left and right
-        ObjectList left_objects, right_objects;
-        partitionObjects(objs, left_objects, right_objects);
-
         Number_t PL = hit_prob(left_box, V), PR = hit_prob(right_box, V);
-        Number_t CP = C(PL, PR, left_objects.size(), right_objects.size());
+        Number_t CP = C(PL, PR, children.leftObjects.size(),
+                        children.rightObjects.size());
+
+        if (shouldStop(objs.size(), CP))
+                return makeLeaf(objs, out);
+
+        // the left child directly follows its parent, the right child is
+        // appended once the whole left subtree has been built
+        uint32_t index = out.nodes.size();
+        out.nodes.emplace_back();
+        out.nodes[index].setInner(sp.lane, sp.oint);
+
+        if (objs.size() < parallelThreshold or
+            ThreadPool::instance().size() == 1) {
+                buildTree(children.leftObjects, children.leftEvents, left_box,
+                          depth + 1, out, ctx);
+                out.nodes[index].setRightChild(out.nodes.size());
+                buildTree(children.rightObjects, children.rightEvents,
+                          right_box, depth + 1, out, ctx);
+                return;
+        }
 
-        if (shouldStop(objs.size(), CP)) {
-                return new LeafNode(objs, V);
-        } else
-                return new InnerNode(sp, V,
-                                     buildTree(left_objects, EL, left_box),
-                                     buildTree(right_objects, ER, right_box));
+        // Large node: the right subtree is built by another thread, with its
+        // own buffers, into its own arrays, and spliced in after the left
+        // subtree
+        Subtree      right;
+        BuildContext rightCtx;
+        BuildLevel & rightLists = rightCtx.levels[depth + 1];
+        rightLists.rightObjects.swap(children.rightObjects);
+        rightLists.rightEvents.swap(children.rightEvents);
+
+        TaskGroup group;
+        group.run([&]() {
+                buildTree(rightLists.rightObjects, rightLists.rightEvents,
+                          right_box, depth + 1, right, rightCtx);
+        });
+        buildTree(children.leftObjects, children.leftEvents, left_box,
+                  depth + 1, out, ctx);
+        group.wait();
+
+        out.nodes[index].setRightChild(out.nodes.size());
+        out.append(right);
+}
+
+void KDTree::makeLeaf(const ObjectList &objs, Subtree &out) {
+        out.nodes.emplace_back();
+        out.nodes.back().setLeaf(out.leafTris.size(), objs.size());
+        out.leafTris.insert(out.leafTris.end(), objs.begin(), objs.end());
+}
+
+void KDTree::Subtree::append(const Subtree &sub) {
+        uint32_t base     = nodes.size();
+        uint32_t leafBase = leafTris.size();
+
+        nodes.reserve(nodes.size() + sub.nodes.size());
+        for (Node n : sub.nodes) {
+                if (n.isLeaf())
+                        n.tris.first += leafBase;
+                else
+                        n.setRightChild(n.rightChild() + base);
+                nodes.push_back(n);
+        }
+        leafTris.insert(leafTris.end(), sub.leafTris.begin(),
+                        sub.leafTris.end());
 }
 
 
@@ -160,7 +521,7 @@ inline bool KDTree::shouldStop(int numTris, Number_t splitCost) const {
  * @brief      Computes the intersection of triangles bounding box and the
  *             box in question
  */
-Box KDTree::clipTriangleToBox(const Triangle *t, const Box &V) const {
+Box KDTree::clipTriangleToBox(const Triangle *t, const Box &V) {
         Box b = t->CalcBounds();
 
         for (int k = 0; k < 3; k++) {
@@ -174,6 +535,69 @@ Box KDTree::clipTriangleToBox(const Triangle *t, const Box &V) const {
         return b;
 }
 
+Box KDTree::clipPolygonToBox(const Triangle *t, const Box &V) {
+        // every plane adds at most one vertex: 3 + 6
+        Number_t buffer[2][9][3];
+        Number_t(*in)[3] = buffer[0], (*out)[3] = buffer[1];
+        int n = 3;
+
+        for (int i = 0; i < 3; i++)
+                for (int k = 0; k < 3; k++)
+                        in[i][k] = t->vertex[i][k];
+
+        for (int k = 0; k < 3; k++) {
+                for (int s = 0; s < 2 and n > 0; s++) {
+                        // points with dist >= 0 are on the inner side
+                        Number_t plane = (s == 0) ? V.low[k] : V.hi[k];
+                        Number_t sign  = (s == 0) ? 1 : -1;
+                        int      m     = 0;
+
+                        for (int i = 0; i < n; i++) {
+                                const Number_t *a  = in[i];
+                                const Number_t *b  = in[(i + 1) % n];
+                                Number_t        da = sign * (a[k] - plane);
+                                Number_t        db = sign * (b[k] - plane);
+
+                                if (da >= 0)
+                                        std::copy(a, a + 3, out[m++]);
+                                if ((da >= 0) != (db >= 0)) {
+                                        // edge crosses the plane
+                                        Number_t u = da / (da - db);
+                                        for (int j = 0; j < 3; j++)
+                                                out[m][j] =
+                                                    a[j] + u * (b[j] - a[j]);
+                                        out[m++][k] = plane;
+                                }
+                        }
+                        n = m;
+                        std::swap(in, out);
+                }
+        }
+
+        Box b = clipTriangleToBox(t, V);
+        if (n == 0)  // only touches V, or rounding
+                return b;
+
+        // bounds of the polygon, kept within the clipped bounding box
+        Box poly(in[0][0], in[0][1], in[0][2], in[0][0], in[0][1], in[0][2]);
+        for (int i = 1; i < n; i++) {
+                for (int k = 0; k < 3; k++) {
+                        poly.low[k] = std::min(poly.low[k], in[i][k]);
+                        poly.hi[k]  = std::max(poly.hi[k], in[i][k]);
+                }
+        }
+        for (int k = 0; k < 3; k++) {
+                b.low[k] = std::max(b.low[k], poly.low[k]);
+                b.hi[k]  = std::min(b.hi[k], poly.hi[k]);
+        }
+        return b;
+}
+
+Box KDTree::clipObject(const Triangle *t, const Box &V) const {
+        return options.perfectSplits ? clipPolygonToBox(t, V)
+                                     : clipTriangleToBox(t, V);
+}
+
 
 
 /**
@@ -183,28 +607,39 @@ Box KDTree::clipTriangleToBox(const Triangle *t, const Box &V) const {
   *             the number of those is small compared to the partioned sublists
   *             Those smaller lists can be sorted and merged with the partioned
   *             list. (See reference)
+  *
+  *             Every list is a buffer of ctx that is cleared, not freed, so
+  *             its storage is reused by the next node
   */
-void KDTree::generateChildList(EventList &events, const Plane &sp,
-                               const Box &V, EventList &EL, EventList &ER) {
+void KDTree::generateChildList(const EventList &events, const Plane &sp,
+                               const Box &V, const ObjectList &objects,
+                               BuildContext &ctx, BuildLevel &children) const {
         // Classify the Triangles
-        classify(events, sp);
+        ctx.sides.assign(objects.size(), Plane::BOTH);
+        classify(events, sp, ctx.sides);
+
+        // split the objects, and find where each one lands in the children
+        children.leftObjects.clear();
+        children.rightObjects.clear();
+        partitionObjects(objects, ctx.sides, children.leftObjects,
+                         children.rightObjects, ctx.leftIndex, ctx.rightIndex);
 
         // partion events into two sorted sublists
-        EventList sortedEL;
-        EventList sortedER;
-        partitionEvents(events, sortedEL, sortedER);
+        children.leftEvents.clear();
+        children.rightEvents.clear();
+        partitionEvents(events, ctx.sides, ctx.leftIndex, ctx.rightIndex,
+                        children.leftEvents, children.rightEvents);
 
         // Generate new unsorted event lists created by triangles that overlap
         // the split plane
-        EventList unsortedEL;
-        EventList unsortedER;
-        generateNewEvents(events, V, sp, unsortedEL, unsortedER);
-
-        // merge the four lists to EL and ER
-        EL.reserve(sortedEL.size() + unsortedEL.size());
-        ER.reserve(sortedER.size() + unsortedER.size());
-        mergeEventList(sortedEL, unsortedEL, EL);
-        mergeEventList(sortedER, unsortedER, ER);
+        ctx.newLeft.clear();
+        ctx.newRight.clear();
+        generateNewEvents(V, sp, objects, ctx.sides, ctx.leftIndex,
+                          ctx.rightIndex, ctx.newLeft, ctx.newRight);
+
+        // merge the new events into the sorted lists
+        mergeEventList(children.leftEvents, ctx.newLeft);
+        mergeEventList(children.rightEvents, ctx.newRight);
 }
 
 /**
@@ -212,29 +647,25 @@ void KDTree::generateChildList(EventList &events, const Plane &sp,
   *             eventlist by keeping track of triangles to the left, right,
   *             and planar to a given candidate (done in all dimensions)
   */
-bool KDTree::findSplit(unsigned numObjects, const Box &V, EventList &events,
-                       Plane &result) {
-        unsigned numLeft[3]   = {0, 0, 0};
-        unsigned numPlanar[3] = {0, 0, 0};
-        unsigned numRight[3]  = {numObjects, numObjects, numObjects};
-        unsigned p_start, p_end, p_planar;
+bool KDTree::findSplit(unsigned numObjects, const Box &V,
+                       const EventList &events, Plane &result) {
+        int      numLeft[3]   = {0, 0, 0};
+        int      numPlanar[3] = {0, 0, 0};
+        int      numRight[3]  = {int(numObjects), int(numObjects),
+                               int(numObjects)};
+        int      p_start, p_end, p_planar;
         bool     foundBest = false;  // whether result has been updated
         Number_t minCost   = std::numeric_limits<Number_t>::max();
 
         // iterate over all split candidates
-        unsigned i = 0;
+        size_t i = 0;
         while (i < events.size()) {
-                Plane &p = events[i].p;
+                Plane p(events[i].lane(), events[i].pos);
                 p_start = p_end = p_planar = 0;
 
-                if (p.oint == V.low[p.lane] || p.oint == V.hi[p.lane]) {
-                        i++;
-                        continue;
-                }
-
                 // count types of events lying on current plane
                 for (; i < events.size() && events[i].is_in(p); i++) {
-                        switch (events[i].type) {
+                        switch (events[i].type()) {
                                 case Event::endsOnPlane: p_end++; break;
                                 case Event::liesOnPlane: p_planar++; break;
                                 case Event::startsOnPlane: p_start++; break;
@@ -245,19 +676,79 @@ bool KDTree::findSplit(unsigned numObjects, const Box &V, EventList &events,
                 numPlanar[p.lane] = p_planar;
                 numRight[p.lane] -= p_planar + p_end;
 
-                // calculate the costs for the split plane
-                float cost = SAHcost(V, &p, numLeft[p.lane], numRight[p.lane],
-                                     numPlanar[p.lane]);
+                // planes on (or, after rounding, outside) the box boundary
+                // do not split it, but still move objects past them
+                if (p.oint > V.low[p.lane] && p.oint < V.hi[p.lane]) {
+                        // calculate the costs for the split plane
+                        float cost = SAHcost(V, &p, numLeft[p.lane],
+                                             numRight[p.lane],
+                                             numPlanar[p.lane]);
+
+                        if (cost < minCost) {
+                                minCost   = cost;
+                                result    = p;
+                                foundBest = true;
+                        }
+                }
 
                 // update the numbers for left
                 numLeft[p.lane] += p_start + p_planar;
                 // reset planar counts for next iteration
                 numPlanar[p.lane] = 0;
+        }
+
+        return foundBest;
+}
 
-                if (cost < minCost) {
-                        minCost   = cost;
-                        result    = p;
-                        foundBest = true;
+/**
+  * @brief      Bins hold the number of objects starting (startBins) and
+  *             ending (endBins) in them. An object is on the left of the
+  *             boundary below bin i if it starts in a bin before i, and on
+  *             its right if it ends in bin i or after
+  */
+bool KDTree::findBinnedSplit(const ObjectList &objects, const Box &V,
+                             BuildContext &ctx, Plane &result) {
+        // small nodes do not need more boundaries than they have objects
+        const unsigned bins = std::min<size_t>(options.bins, objects.size());
+        bool     foundBest = false;  // whether result has been updated
+        Number_t minCost   = std::numeric_limits<Number_t>::max();
+        Number_t scale[3];
+
+        for (unsigned k = X; k <= Z; k++)
+                scale[k] = (V.d(k) > 0) ? bins / V.d(k) : 0;
+
+        // fill the bins of all axes in one pass over the objects
+        ctx.bounds.resize(objects.size());
+        ctx.startBins.assign(3 * bins, 0);
+        ctx.endBins.assign(3 * bins, 0);
+        for (size_t i = 0; i < objects.size(); i++) {
+                const Box &b = ctx.bounds[i] =
+                    clipObject(triangles[objects[i]], V);
+                for (unsigned k = X; k <= Z; k++) {
+                        int lo = (b.low[k] - V.low[k]) * scale[k];
+                        int hi = (b.hi[k] - V.low[k]) * scale[k];
+                        ctx.startBins[k * bins + std::min<int>(lo, bins - 1)]++;
+                        ctx.endBins[k * bins + std::min<int>(hi, bins - 1)]++;
+                }
+        }
+
+        // sweep the bin boundaries of each axis
+        for (unsigned k = X; k <= Z; k++) {
+                if (scale[k] == 0)
+                        continue;
+
+                int numLeft = 0, numRight = objects.size();
+                for (unsigned i = 1; i < bins; i++) {
+                        numLeft += ctx.startBins[k * bins + i - 1];
+                        numRight -= ctx.endBins[k * bins + i - 1];
+
+                        Plane p(k, V.low[k] + i * V.d(k) / bins);
+                        float cost = SAHcost(V, &p, numLeft, numRight, 0);
+                        if (cost < minCost) {
+                                minCost   = cost;
+                                result    = p;
+                                foundBest = true;
+                        }
                 }
         }
 
@@ -265,29 +756,50 @@ bool KDTree::findSplit(unsigned numObjects, const Box &V, EventList &events,
 }
 
 /**
-  * @brief      Sets the side field of the Object, classifying them into
-  *             LEFT, RIGHT, or BOTH
+  * @brief      Objects touching the plane from one side only go to that
+  *             side, planar objects lying on it go left
   */
-void KDTree::classify(EventList &events, const Plane &p) {
-        // set all 'side' fields to 'both'
-        for (Event &e : events)
-                e.obj->side = Plane::BOTH;
+void KDTree::generateBinnedChildList(const ObjectList &objects,
+                                     const Plane &sp, BuildContext &ctx,
+                                     BuildLevel &children) const {
+        children.leftObjects.clear();
+        children.rightObjects.clear();
+        for (size_t i = 0; i < objects.size(); i++) {
+                const Box &b = ctx.bounds[i];
+                if (b.hi[sp.lane] <= sp.oint)
+                        children.leftObjects.push_back(objects[i]);
+                else if (b.low[sp.lane] >= sp.oint)
+                        children.rightObjects.push_back(objects[i]);
+                else {
+                        children.leftObjects.push_back(objects[i]);
+                        children.rightObjects.push_back(objects[i]);
+                }
+        }
+}
 
-        for (Event &e : events) {
-                if (e.p.lane != p.lane)
+/**
+  * @brief      Classifies the objects of a node into LEFT, RIGHT, or BOTH.
+  *             The result is kept per node (not in the shared Objects), so
+  *             that sibling subtrees can be built concurrently
+  */
+void KDTree::classify(const EventList &events, const Plane &p,
+                      SideList &sides) const {
+        for (const Event &e : events) {
+                if (e.lane() != p.lane)
                         continue;
 
-                if (e.type == Event::endsOnPlane && e.p.oint <= p.oint)
-                        e.obj->side = Plane::LEFT;
-                else if (e.type == Event::startsOnPlane && e.p.oint >= p.oint)
-                        e.obj->side = Plane::RIGHT;
-                else if (e.type == Event::liesOnPlane) {
-                        if (e.p.oint < p.oint)
-                                e.obj->side = Plane::LEFT;
-                        else if (e.p.oint > p.oint)
-                                e.obj->side = Plane::RIGHT;
-                        else // (e.p.oint == p.oint)
-                                e.obj->side = p.side;
+                Event::EventType type = e.type();
+                if (type == Event::endsOnPlane && e.pos <= p.oint)
+                        sides[e.obj()] = Plane::LEFT;
+                else if (type == Event::startsOnPlane && e.pos >= p.oint)
+                        sides[e.obj()] = Plane::RIGHT;
+                else if (type == Event::liesOnPlane) {
+                        if (e.pos < p.oint)
+                                sides[e.obj()] = Plane::LEFT;
+                        else if (e.pos > p.oint)
+                                sides[e.obj()] = Plane::RIGHT;
+                        else // (e.pos == p.oint)
+                                sides[e.obj()] = p.side;
                 }
         }
 }
@@ -297,28 +809,45 @@ void KDTree::classify(EventList &events, const Plane &p) {
 /**
   * @brief      Generates new events for objects overlapping a split plane
   */
-void KDTree::generateNewEvents(const EventList &events, const Box &V,
-                               const Plane &p, EventList &EBL,
-                               EventList &EBR) {
+void KDTree::generateNewEvents(const Box &V, const Plane &p,
+                               const ObjectList &objects,
+                               const SideList & sides,
+                               const IndexList &left_index,
+                               const IndexList &right_index, EventList &EBL,
+                               EventList &EBR) const {
         Box lbox, rbox;
         splitBox(V, p, lbox, rbox);
 
-        // iterate over the events and split those which lie on both sides
-        for (const Event &e : events) {
-                if (e.obj->side == Plane::BOTH) {
-                        Box lclip = clipTriangleToBox(e.obj->tri, lbox);
-                        Box rclip = clipTriangleToBox(e.obj->tri, rbox);
-                        generateEvent(lclip, e.p.lane, e.obj, EBL);
-                        generateEvent(rclip, e.p.lane, e.obj, EBR);
+        // clip the objects which lie on both sides to either child
+        for (size_t i = 0; i < objects.size(); i++) {
+                if (sides[i] != Plane::BOTH)
+                        continue;
+
+                const Triangle *tri   = triangles[objects[i]];
+                Box             lclip = clipObject(tri, lbox);
+                Box             rclip = clipObject(tri, rbox);
+                for (unsigned k = X; k <= Z; k++) {
+                        generateEvent(lclip, k, left_index[i], EBL);
+                        generateEvent(rclip, k, right_index[i], EBR);
                 }
         }
 }
 
-void KDTree::mergeEventList(EventList &sorted, EventList &unsorted,
-                            EventList &output) {
+/**
+  * @brief      Merges from the back, so that sorted only grows by the size of
+  *             unsorted and no temporary list is needed
+  */
+void KDTree::mergeEventList(EventList &sorted, EventList &unsorted) const {
         std::sort(unsorted.begin(), unsorted.end());
-        std::merge(sorted.begin(), sorted.end(), unsorted.begin(),
-                   unsorted.end(), std::back_inserter(output));
+
+        size_t i = sorted.size(), j = unsorted.size(), k = i + j;
+        sorted.resize(k);
+        while (j > 0) {
+                if (i > 0 && unsorted[j - 1] < sorted[i - 1])
+                        sorted[--k] = sorted[--i];
+                else
+                        sorted[--k] = unsorted[--j];
+        }
 }
 
 
@@ -326,12 +855,20 @@ void KDTree::mergeEventList(EventList &sorted, EventList &unsorted,
 /**
   * @brief      Partitions events into two sublists
   */
-void KDTree::partitionEvents(const EventList &events, EventList &EL,
-                             EventList &ER) {
+void KDTree::partitionEvents(const EventList &events, const SideList &sides,
+                             const IndexList &left_index,
+                             const IndexList &right_index, EventList &EL,
+                             EventList &ER) const {
         for (const Event &e : events) {
-                switch (e.obj->side) {
-                        case Plane::LEFT: EL.push_back(e); break;
-                        case Plane::RIGHT: ER.push_back(e); break;
+                switch (sides[e.obj()]) {
+                        case Plane::LEFT:
+                                EL.push_back(e);
+                                EL.back().setObj(left_index[e.obj()]);
+                                break;
+                        case Plane::RIGHT:
+                                ER.push_back(e);
+                                ER.back().setObj(right_index[e.obj()]);
+                                break;
                         default: break;  // Plane::BOTH events are ignored
                 }
         }
@@ -341,13 +878,27 @@ void KDTree::partitionEvents(const EventList &events, EventList &EL,
 /**
   * @brief      Partitions objects into two sublists
   */
-void KDTree::partitionObjects(const ObjectList &objects, ObjectList &left_list,
-                              ObjectList &right_list) {
-        for (Object *tmp : objects) {
-                switch (tmp->side) {
-                        case Plane::LEFT: left_list.push_back(tmp); break;
-                        case Plane::RIGHT: right_list.push_back(tmp); break;
+void KDTree::partitionObjects(const ObjectList &objects, const SideList &sides,
+                              ObjectList &left_list, ObjectList &right_list,
+                              IndexList &left_index,
+                              IndexList &right_index) const {
+        left_index.assign(objects.size(), UINT32_MAX);
+        right_index.assign(objects.size(), UINT32_MAX);
+
+        for (size_t i = 0; i < objects.size(); i++) {
+                uint32_t tmp = objects[i];
+                switch (sides[i]) {
+                        case Plane::LEFT:
+                                left_index[i] = left_list.size();
+                                left_list.push_back(tmp);
+                                break;
+                        case Plane::RIGHT:
+                                right_index[i] = right_list.size();
+                                right_list.push_back(tmp);
+                                break;
                         case Plane::BOTH:
+                                left_index[i]  = left_list.size();
+                                right_index[i] = right_list.size();
                                 left_list.push_back(tmp);
                                 right_list.push_back(tmp);
                                 break;
@@ -357,16 +908,36 @@ void KDTree::partitionObjects(const ObjectList &objects, ObjectList &left_list,
 }
 
 
+/**
+  * @brief      Rounds x to the closest float not greater than x
+  */
+static inline float roundDown(Number_t x) {
+        float f = x;
+        return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::max())
+                       : f;
+}
+
+/**
+  * @brief      Rounds x to the closest float not less than x
+  */
+static inline float roundUp(Number_t x) {
+        float f = x;
+        return (f < x) ? std::nextafter(f, std::numeric_limits<float>::max())
+                       : f;
+}
+
 /**
   * @brief      Generates candidate split plane events
   */
-void KDTree::generateEvent(const Box &box, unsigned k, Object *obj,
-                           EventList &list) {
-        if (box.isPlanar(k)) {
-                list.emplace_back(k, box.low[k], Event::liesOnPlane, obj);
+void KDTree::generateEvent(const Box &box, unsigned k, uint32_t obj,
+                           EventList &list) const {
+        float low = roundDown(box.low[k]), hi = roundUp(box.hi[k]);
+
+        if (low >= hi) {
+                list.emplace_back(k, low, Event::liesOnPlane, obj);
         } else {
-                list.emplace_back(k, box.low[k], Event::startsOnPlane, obj);
-                list.emplace_back(k, box.hi[k], Event::endsOnPlane, obj);
+                list.emplace_back(k, low, Event::startsOnPlane, obj);
+                list.emplace_back(k, hi, Event::endsOnPlane, obj);
         }
 }
 }  // namespace RayTracerxx
\ No newline at end of file
@@ -3,7 +3,11 @@
 
 #include <time.h>
 #include <cassert>
+#include <atomic>
 #include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <vector>
 #include "Box.h"
 #include "OrderedList.h"
@@ -12,6 +16,36 @@
 
 namespace RayTracerxx {
 
+/**
+ * @brief      Allocates arrays aligned on cache lines, which std::allocator
+ *             does not do for over-aligned types before C++17
+ */
+template <class T>
+struct CacheAlignedAllocator {
+        typedef T value_type;
+
+        CacheAlignedAllocator() {}
+        template <class U>
+        CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+        T *allocate(size_t n) {
+                void *p = NULL;
+                if (posix_memalign(&p, 64, n * sizeof(T)) != 0)
+                        throw std::bad_alloc();
+                return static_cast<T *>(p);
+        }
+        void deallocate(T *p, size_t) { free(p); }
+
+        template <class U>
+        bool operator==(const CacheAlignedAllocator<U> &) const {
+                return true;
+        }
+        template <class U>
+        bool operator!=(const CacheAlignedAllocator<U> &) const {
+                return false;
+        }
+};
+
 /**
  * @brief      K-Dimensional (KD) Tree implementation
  *
@@ -22,6 +56,61 @@ namespace RayTracerxx {
  *             ray tracing, and on doing that in O(N log N).
  */
 class KDTree {
+public:
+        /**
+         * @brief      Build settings, trading build time for tree quality
+         */
+        struct BuildOptions {
+                // 0 evaluates the SAH at every event of the sorted event
+                // list. Otherwise the number of bins per axis: the SAH is
+                // only evaluated at bin boundaries, and no events are
+                // generated or sorted
+                unsigned bins;
+
+                // Whether objects straddling a split plane are bounded by
+                // clipping the triangle itself to the child boxes, instead
+                // of its bounding box. Tighter children, slower build
+                bool perfectSplits;
+
+                BuildOptions() : bins(0), perfectSplits(false) {}
+        };
+
+        /**
+         * @brief      Shape and cost of a built tree, to compare builds of
+         *             the same scene
+         */
+        struct Report {
+                // leafHistogram[b] counts leaves holding 0, 1, 2, 3-4, 5-8,
+                // ..., 33-64 and more than 64 triangles
+                static constexpr int histogramSize = 9;
+
+                int      numInner, numLeaves, emptyLeaves;
+                int      maxLeafDepth;
+                double   avgLeafDepth;
+                size_t   leafHistogram[histogramSize];
+                size_t   references;  // triangle references of all leaves
+                size_t   uniqueTris;  // triangles referenced at least once
+                double   duplication;  // references / uniqueTris
+                Number_t sahCost;
+                size_t   nodeBytes, leafBytes;
+                size_t   accelBytes;   // intersection records (TriAccel)
+                size_t   buildEvents;  // events of all nodes, 0 if binned
+
+                /**
+                 * @brief      Prints the report for humans
+                 *
+                 * @param      out   The stream
+                 */
+                void print(std::ostream &out) const;
+
+                /**
+                 * @brief      Prints the report as a one line JSON object
+                 *
+                 * @param      out   The stream
+                 */
+                void printJSON(std::ostream &out) const;
+        };
+
 private:
         /*
          *                                 Structs
@@ -47,136 +136,55 @@ private:
         };
 
         /**
-         * @brief      Internal representation of primitives in the KDTree
-         */
-        struct Object {
-                Triangle *  tri;
-                Plane::Side side;
-
-                // constructor
-                Object(Triangle *p) {
-                        tri  = p;
-                        side = Plane::BOTH;
-                }
-
-                // constructor with all fields
-                Object(Triangle *p, Plane::Side s) {
-                        tri  = p;
-                        side = s;
-                }
-        };
-
-        /**
-         * @brief      Abstract Node Class
+         * @brief      Node of the flattened tree
+         *
+         * @details    All nodes live in one contiguous array (nodes). The
+         *             left child of an inner node is the node right after
+         *             it, the index of the right child is stored in the
+         *             node. Leaves store a range of the shared leafTris
+         *             array.
+         *
+         *             flags  bits 0-1   split axis (X, Y, Z) or LEAF
+         *                    bits 2-31  index of the right child
          */
         struct Node {
-                virtual ~Node() {}
-                virtual void traverse(Ray &, Number_t, Number_t) = 0;
-                virtual int  depth(int d) const                  = 0;
-        };
-
-        /**
-         * @brief      Inner Node Class
-         */
-        struct InnerNode : public Node {
-                Plane p;
-                Node *left, *right;
-
-                InnerNode(const Plane &p0, const Box &V0, Node *lc, Node *rc)
-                    : p(p0), left(lc), right(rc) {
-                        (void)V0;
-                }
+                enum { LEAF = 3, AXIS_BITS = 2 };
 
                 /**
-                 * @brief      Traverses the tree  "in-order".
-                 *
-                 *
-                 * @details    Determines where the ray traverses the area
-                 *             befere and after the split plane.
-                 *             Recursively explores those two regions
-                 *
-                 * @param      ray    The ray
-                 * @param[in]  t_min  The t minimum
-                 * @param[in]  t_max  The t maximum
+                 * @brief      Range of leafTris belonging to a leaf
                  */
-                virtual void traverse(Ray &ray, Number_t t_min,
-                                      Number_t t_max) {
-                        // finds when ray intersects split plane
-                        Number_t t_split =
-                            (p.oint - ray.origin[p.lane]) * ray.inv(p.lane);
-
-                        // finds the plane closest to ray origin
-                        Node *near, *far;
-                        near = (ray.origin[p.lane] < p.oint) ? left : right;
-                        far  = (ray.origin[p.lane] < p.oint) ? right : left;
-
-                        // only traverse near if ray exits before hitting far
-                        if (t_split > t_max or t_split < 0)
-                                near->traverse(ray, t_min, t_max);
-                        // only traverse far if ray exits before hitting near
-                        else if (t_split < t_min)
-                                far->traverse(ray, t_min, t_max);
-                        else {
-                                // tries near, then goes far if no hit
-                                near->traverse(ray, t_min, t_split);
-                                // Stop if ray hits something before reaching
-                                // far
-                                if (ray.t < t_split)
-                                        return;
-                                far->traverse(ray, t_split, t_max);
-                        }
-                }
-
-                virtual int depth(int d) const {
-                        return std::max(left->depth(d + 1),
-                                        right->depth(d + 1));
-                }
-
-                virtual ~InnerNode() {
-                        delete left;
-                        delete right;
+                struct Range {
+                        uint32_t first;
+                        uint32_t count;
                 };
-        };
 
-        /**
-         * @brief      Leaf Node class.
-         *
-         * @details    Holds a list of triangles
-         */
-        struct LeafNode : public Node {
-                std::vector<Triangle *> T;
-                Box                     V;
-
-                LeafNode(std::vector<Triangle *> &T0, const Box &V0)
-                    : T(T0), V(V0) {}
+                union {
+                        Number_t split;  // inner node: splitting point
+                        Range    tris;   // leaf: triangles of the leaf
+                };
+                uint32_t flags;
 
-                LeafNode(const std::vector<Object *> &O, const Box &V0)
-                    : V(V0) {
-                        T.reserve(O.size());
-                        for (Object *a : O)
-                                T.push_back(a->tri);
+                void setInner(int axis, Number_t point) {
+                        split = point;
+                        flags = axis;
                 }
 
-                /**
-                 * @brief      Iterates through all triangles and performs
-                 *             intersection test
-                 *
-                 * @param      ray    The ray
-                 * @param[in]  t_min  The t minimum
-                 * @param[in]  t_max  The t maximum
-                 */
-                virtual void traverse(Ray &ray, Number_t t_min,
-                                      Number_t t_max) {
-                        (void)t_min;
-                        (void)t_max;
-                        for (Triangle *tri : T)
-                                tri->Intersect(ray);
+                void setRightChild(uint32_t index) {
+                        assert(index < (1u << (32 - AXIS_BITS)));
+                        flags = (index << AXIS_BITS) | axis();
                 }
 
-                virtual int depth(int d) const { return d; }
+                void setLeaf(uint32_t first, uint32_t count) {
+                        tris.first = first;
+                        tris.count = count;
+                        flags      = LEAF;
+                }
 
-                virtual ~LeafNode(){};
+                bool     isLeaf() const { return axis() == LEAF; }
+                int      axis() const { return flags & ((1 << AXIS_BITS) - 1); }
+                uint32_t rightChild() const { return flags >> AXIS_BITS; }
         };
+        static_assert(sizeof(Node) <= 16, "KDTree nodes must stay compact");
 
         /**
          * @brief      Representation of a split plane candidate
@@ -185,6 +193,18 @@ private:
          *             the object that generated that event, and how the
          *             event was generated (type:starts on the plane,
          *             ends on the plane, or lies completely on the plane)
+         *
+         *             Events make up most of the memory used by the build,
+         *             so they are packed in 8 bytes: the position as a float
+         *             (rounded outwards, see generateEvent) and one word for
+         *             the rest. The object is referenced by its position in
+         *             the ObjectList of the node owning the event, so that
+         *             per object scratch data (see SideList) can be kept
+         *             per node
+         *
+         *             bits  bits 0-1   type
+         *                   bits 2-3   dimension
+         *                   bits 4-31  object
          */
         struct Event {
                 typedef enum {
@@ -192,25 +212,43 @@ private:
                         liesOnPlane,
                         startsOnPlane
                 } EventType;
+                enum { LANE_SHIFT = 2, OBJ_SHIFT = 4 };
 
-                Object *  obj;
-                Plane     p;
-                EventType type;
+                float    pos;
+                uint32_t bits;
 
-                Event(int k, Number_t point, EventType newType)
-                    : obj(NULL), p(k, point), type(newType) {}
+                Event() : pos(0), bits(0) {}
 
-                Event(int k, Number_t point, EventType newType, Object *ob)
-                    : Event(k, point, newType) {
-                        obj = ob;
+                Event(int k, float point, EventType newType, uint32_t ob)
+                    : pos(point) {
+                        assert(ob < (1u << (32 - OBJ_SHIFT)));
+                        bits = (ob << OBJ_SHIFT) | (k << LANE_SHIFT) | newType;
+                }
+
+                EventType type() const { return EventType(bits & 3); }
+                int       lane() const { return (bits >> LANE_SHIFT) & 3; }
+                uint32_t  obj() const { return bits >> OBJ_SHIFT; }
+
+                void setObj(uint32_t ob) {
+                        bits = (ob << OBJ_SHIFT) |
+                               (bits & ((1u << OBJ_SHIFT) - 1));
                 }
 
                 /**
                  * @brief      Comparison as defined by reference paper
+                 *
+                 * @details    Events of different dimensions at the same
+                 *             point are ordered by dimension, so that all the
+                 *             events of a plane are adjacent (findSplit
+                 *             counts them in one run) and the order does not
+                 *             depend on the sorting algorithm. The low bits
+                 *             hold the dimension, then the type
                  */
                 bool operator<(const Event &e) const {
-                        return ((p.oint < e.p.oint) or
-                                (p.oint == e.p.oint && type < e.type));
+                        if (pos != e.pos)
+                                return pos < e.pos;
+                        return (bits & ((1u << OBJ_SHIFT) - 1)) <
+                               (e.bits & ((1u << OBJ_SHIFT) - 1));
                 }
 
                 /**
@@ -219,17 +257,68 @@ private:
                  *
                  * @return     True if in, False otherwise.
                  */
-                bool is_in(const Plane &toTest) const { return p == toTest; }
+                bool is_in(const Plane &toTest) const {
+                        return pos == toTest.oint and lane() == toTest.lane;
+                }
         };
+        static_assert(sizeof(Event) == 8, "KDTree events must stay compact");
 
         /*
          *                                  Typedefs
          */
         typedef std::vector<Event>      EventList;
         typedef std::vector<Triangle *> TriList;
-        typedef std::vector<Object *>   ObjectList;
+        typedef std::vector<uint32_t>   ObjectList;  // indices in triangles
+        typedef std::vector<Plane::Side> SideList;  // side of each object
+        typedef std::vector<uint32_t>   IndexList;  // object index in child
         typedef enum { X = 0, Y, Z } Dimension;
 
+        /**
+         * @brief      Nodes and leaf triangle indices of a (sub)tree, laid
+         *             out as in KDTree::nodes and KDTree::leafTris
+         */
+        struct Subtree {
+                std::vector<Node>     nodes;
+                std::vector<uint32_t> leafTris;
+
+                /**
+                 * @brief      Appends another subtree, rebasing its child
+                 *             indices and leaf ranges
+                 *
+                 * @param[in]  sub   The subtree
+                 */
+                void append(const Subtree &sub);
+        };
+
+        /**
+         * @brief      Object and event lists of the two children of a node
+         */
+        struct BuildLevel {
+                ObjectList leftObjects, rightObjects;
+                EventList  leftEvents, rightEvents;
+        };
+
+        /**
+         * @brief      Buffers reused by all the nodes built by one thread
+         *
+         * @details    The children of a node at depth d are built from
+         *             levels[d + 1]. A depth first build only needs the
+         *             children lists of one node per depth at a time, so
+         *             after the first few nodes the buffers are large enough
+         *             and the build stops allocating. The scratch lists are
+         *             only used while a node is split
+         */
+        struct BuildContext {
+                std::vector<BuildLevel> levels;
+                SideList                sides;
+                IndexList               leftIndex, rightIndex;
+                EventList               newLeft, newRight;
+                std::vector<Box>        bounds;  // binned: clipped objects
+                std::vector<unsigned>   startBins, endBins;
+
+                BuildContext() : levels(maxDepth + 1) {}
+        };
+
         /*
          *                                   Methods
          */
@@ -241,23 +330,52 @@ private:
          *
          * @param      tris  The triangles
          * @param      V     The bounding box for all the triangles
-         *
-         * @return     The root of the KDTree
          */
-        Node *buildTree(TriList &tris, const Box &V);
+        void buildTree(TriList &tris, const Box &V);
 
         /**
          * @brief      Builds a tree.
          *
-         * @details    Recursively constructs nodes of the tree
+         * @details    Recursively appends the nodes of the subtree to out,
+         *             in depth first order. Large subtrees build their right
+         *             child as a ThreadPool task
          *
          * @param      objects  The objects
          * @param      events   The events
          * @param[in]  V        Bounding box for current subtree
+         * @param[in]  depth    Depth of the subtree root
+         * @param      out      The tree being built (output parameter)
+         * @param      ctx      The calling thread's buffers
+         */
+        void buildTree(const ObjectList &objects, const EventList &events,
+                       const Box &V, int depth, Subtree &out,
+                       BuildContext &ctx);
+
+        /**
+         * @brief      Appends a leaf holding objects to out
          *
-         * @return     The root of the sub-KDTree.
+         * @param[in]  objects  The objects
+         * @param      out      The tree being built (output parameter)
          */
-        Node *buildTree(ObjectList &objects, EventList &events, const Box &V);
+        void makeLeaf(const ObjectList &objects, Subtree &out);
+
+        /**
+         * @brief      Subtree still to be visited by a traversal
+         */
+        struct StackEntry {
+                uint32_t node;
+                Number_t t_min, t_max;
+        };
+
+        /**
+         * @brief      Computes the depth of the deepest leaf below node
+         *
+         * @param[in]  node  Index of the subtree root
+         * @param[in]  d     Depth of node
+         *
+         * @return     Maximum depth
+         */
+        int depth(uint32_t node, int d) const;
 
         /**
          * @brief      Checks whether the build tree termination criteria has
@@ -344,8 +462,59 @@ private:
          *
          * @return     Whether the optimal split plane could be found
          */
-        bool findSplit(unsigned numObjects, const Box &V, EventList &events,
-                       Plane &result);
+        bool findSplit(unsigned numObjects, const Box &V,
+                       const EventList &events, Plane &result);
+
+        /**
+         * @brief      Finds the best split plane among the bin boundaries
+         *
+         * @details    Counts where the objects start and end in one pass
+         *             over the objects, then sweeps the bins of each axis.
+         *             Leaves the objects clipped to V in ctx.bounds
+         *
+         * @param[in]  objects  The objects
+         * @param[in]  V        The bounding box
+         * @param      ctx      The calling thread's buffers
+         * @param      result   The result (output parameter)
+         *
+         * @return     Whether a split plane could be found
+         */
+        bool findBinnedSplit(const ObjectList &objects, const Box &V,
+                             BuildContext &ctx, Plane &result);
+
+        /**
+         * @brief      Generates the children object lists of a binned split
+         *
+         * @param[in]  objects   The objects
+         * @param[in]  sp        The split plane
+         * @param      ctx       The buffers filled by findBinnedSplit
+         * @param      children  The children lists (output parameter)
+         */
+        void generateBinnedChildList(const ObjectList &objects,
+                                     const Plane &sp, BuildContext &ctx,
+                                     BuildLevel &children) const;
+
+        /**
+         * @brief      Computes the SAH cost of a subtree
+         *
+         * @param[in]  node  Index of the subtree root
+         * @param[in]  V     Bounding box of the subtree
+         *
+         * @return     Cost, relative to the area of V
+         */
+        Number_t sahCost(uint32_t node, const Box &V) const;
+
+        /**
+         * @brief      Adds the nodes of a subtree to a report
+         *
+         * @param[in]  node    Index of the subtree root
+         * @param[in]  d       Depth of node
+         * @param      report  The report (output parameter)
+         * @param      seen    Whether each triangle has been seen in a leaf
+         *                     (output parameter)
+         */
+        void report(uint32_t node, int d, Report &report,
+                    std::vector<bool> &seen) const;
 
         /**
          * @brief      Divides a box into two subboxes along a split plane
@@ -359,104 +528,144 @@ private:
                       Box &subRight) const;
 
         /**
-         * @brief      Computes the intersection of triangles bounding box and
-         *             the box in question
-         *             Note: A non empty intersection is assumed
+         * @brief      Bounds a triangle within a node box, as selected by
+         *             options.perfectSplits
          *
          * @param      t     Triangle
          * @param[in]  V     Containing box
          *
          * @return     Non empty intersection of the two boxes
          */
-        Box clipTriangleToBox(const Triangle *t, const Box &V) const;
+        Box clipObject(const Triangle *t, const Box &V) const;
 
         /**
          * @brief      Classifies the each event's Object into LEFT, RIGHT
          *             or BOTH
          *
-         * @param      events  The events
+         * @param[in]  events  The events
          * @param[in]  p       The split plane
+         * @param      sides   Side of each object, initially BOTH (output
+         *                     parameter)
          */
-        void classify(EventList &events, const Plane &p);
+        void classify(const EventList &events, const Plane &p,
+                      SideList &sides) const;
 
         /**
          * @brief      Generate events in the k-th dimension using obj's
          *             bounding box, and adds them to the event list
          *
+         * @details    Positions are rounded outwards to float, so that the
+         *             events never claim less space than the object covers
+         *
          * @param[in]  box   The bounding box
          * @param[in]  k     The dimension
-         * @param      obj   The object
+         * @param[in]  obj   Index of the object
          * @param      list  The event list (output parameter )
          */
-        void generateEvent(const Box &box, unsigned k, Object *obj,
-                           EventList &list);
+        void generateEvent(const Box &box, unsigned k, uint32_t obj,
+                           EventList &list) const;
 
         /**
          * @brief      Generates new lists to be added to children's event
-         *             lists
+         *             lists, from the objects overlapping the split plane
          *
-         * @param      events  The events
-         * @param[in]  V       The bounding box
-         * @param[in]  p       The split plane
-         * @param      EBL     The ebl (output parameter)
-         * @param      EBR     The ebr (output parameter)
+         * @param[in]  V           The bounding box
+         * @param[in]  p           The split plane
+         * @param[in]  objects     The objects
+         * @param[in]  sides       Side of each object
+         * @param[in]  left_index  Index of each object in the left child
+         * @param[in]  right_index Index of each object in the right child
+         * @param      EBL         The ebl (output parameter)
+         * @param      EBR         The ebr (output parameter)
          */
-        void generateNewEvents(const EventList &events, const Box &V,
-                               const Plane &p, EventList &EBL, EventList &EBR);
+        void generateNewEvents(const Box &V, const Plane &p,
+                               const ObjectList &objects,
+                               const SideList & sides,
+                               const IndexList &left_index,
+                               const IndexList &right_index, EventList &EBL,
+                               EventList &EBR) const;
 
         /**
-         * @brief      Merges a sorted and unsorted event list into a larger
-         *             event list
+         * @brief      Merges an unsorted event list into a sorted event list
          *
-         * @param      sorted    The sorted event list
-         * @param      unsorted  The unsorted event list
-         * @param      output    The output event list (output parameter)
+         * @param      sorted    The sorted event list (output parameter)
+         * @param      unsorted  The unsorted event list, sorted on return
          */
-        void mergeEventList(EventList &sorted, EventList &unsorted,
-                            EventList &output);
+        void mergeEventList(EventList &sorted, EventList &unsorted) const;
 
         /**
          * @brief      Partitions objects into a left object list and a right
          *             object list
          *
          * @param[in]  objects     The object list
+         * @param[in]  sides       Side of each object
          * @param      left_list   The left object list  (output parameter)
          * @param      right_list  The right object list (output parameter)
+         * @param      left_index  Index of each object in left_list
+         *                         (output parameter)
+         * @param      right_index Index of each object in right_list
+         *                         (output parameter)
          */
-        void partitionObjects(const ObjectList &objects, ObjectList &left_list,
-                              ObjectList &right_list);
+        void partitionObjects(const ObjectList &objects, const SideList &sides,
+                              ObjectList &left_list, ObjectList &right_list,
+                              IndexList &left_index,
+                              IndexList &right_index) const;
 
         /**
          * @brief      Partitions events into a left event list and a right
          *             event list
          *
-         * @param[in]  events  The event list
-         * @param      ELO     The left event list (output parameter)
-         * @param      ERO     The right event list (output parameter)
+         * @param[in]  events      The event list
+         * @param[in]  sides       Side of each object
+         * @param[in]  left_index  Index of each object in the left child
+         * @param[in]  right_index Index of each object in the right child
+         * @param      ELO         The left event list (output parameter)
+         * @param      ERO         The right event list (output parameter)
          */
-        void partitionEvents(const EventList &events, EventList &ELO,
-                             EventList &ERO);
+        void partitionEvents(const EventList &events, const SideList &sides,
+                             const IndexList &left_index,
+                             const IndexList &right_index, EventList &ELO,
+                             EventList &ERO) const;
 
         /**
-         * @brief      Generates left and right event lists from a larger
-         *             event list
-         *
-         * @param      events  The events
-         * @param      sp      The split plane
-         * @param[in]  V       The bounding box
-         * @param      EL      The left event list (output parameter)
-         * @param      ER      The right event list (output parameter)
-         */
-        void  generateChildList(EventList &events, const Plane &sp,
-                                const Box &V, EventList &EL, EventList &ER);
-        Node *root;
-        int   num_nodes;
-        Box   bbox;
+         * @brief      Generates left and right event and object lists from a
+         *             node's lists
+         *
+         * @param[in]  events    The events
+         * @param[in]  sp        The split plane
+         * @param[in]  V         The bounding box
+         * @param[in]  objects   The objects
+         * @param      ctx       The calling thread's buffers
+         * @param      children  The children lists (output parameter)
+         */
+        void generateChildList(const EventList &events, const Plane &sp,
+                               const Box &V, const ObjectList &objects,
+                               BuildContext &ctx, BuildLevel &children) const;
+        std::vector<Node>     nodes;      // nodes[0] is the root
+        std::vector<uint32_t> leafTris;   // triangle indices of all leaves
+        TriList               triangles;  // all triangles of the tree
+        std::vector<TriAccel, CacheAlignedAllocator<TriAccel>>
+            accel;  // accel[i] tests triangles[i], one cache line each
+        std::atomic<int>      num_nodes;
+        std::atomic<size_t>   num_events;  // summed over the nodes built
+        Box                   bbox;
+        BuildOptions          options;
         static constexpr Number_t ki = 1.0;  // triangle  intersection cost
         static constexpr Number_t kt = 1.5;  // traversal cost
 
+        // Deepest level the builder creates. Bounds the traversal stack:
+        // a ray pushes at most one far child per level
+        static constexpr int maxDepth = 64;
+
+        // Nodes with at least this many objects build their children in
+        // parallel
+        static constexpr size_t parallelThreshold = 4096;
+
+        // Nodes with at least this many objects are recorded by the Tracer
+        static constexpr size_t traceThreshold = 16384;
+
 public:
-        KDTree() : root(NULL) {}
+        KDTree() : num_nodes(0), num_events(0) {}
 
         /**
          * @brief      Builds a KDTree using the provided triangles and the
@@ -464,13 +673,42 @@ public:
          *
          * @param[in]  sceneBox   The scene bounding box
          * @param[in]  triangles  The triangles
+         * @param[in]  opts       The build settings
+         */
+        KDTree(Box sceneBox, std::vector<Triangle *> triangles,
+               BuildOptions opts = BuildOptions());
+
+        /**
+         * @brief      Estimates the cost of tracing a ray through the tree
+         *             with the surface area heuristic
+         *
+         * @details    Sums the traversal cost of inner nodes and the
+         *             intersection cost of leaves, weighted by the
+         *             probability of a ray hitting the scene box to hit
+         *             them. Lower is better; comparable between builds of
+         *             the same scene
+         *
+         * @return     The SAH cost
+         */
+        Number_t sahCost() const;
+
+        /**
+         * @brief      Gets the number of nodes built
+         */
+        size_t numNodes() const { return num_nodes; }
+
+        /**
+         * @brief      Gets the number of triangles in the tree
          */
-        KDTree(Box sceneBox, std::vector<Triangle *> triangles);
+        size_t numTriangles() const { return triangles.size(); }
 
         /**
-         * @brief      Destroys the object.
+         * @brief      Measures the tree: depth, leaf occupancy, triangle
+         *             duplication, SAH cost and memory
+         *
+         * @return     The report
          */
-        ~KDTree() { delete root; }
+        Report report() const;
 
         /**
          * @brief      Intersects the ray with the triangles in the scene
@@ -479,7 +717,48 @@ public:
          *
          * @return     Whether there was an intersection
          */
-        bool Intersect(Ray &ray);
+        bool Intersect(Ray &ray) const;
+
+        /**
+         * @brief      Checks whether any triangle lies on the ray closer than
+         *             tmax (any hit query, used for shadow rays)
+         *
+         * @details    Returns as soon as a hit is found, so ray.hit and ray.t
+         *             describe some occluder, not necessarily the nearest
+         *
+         * @param      ray   The ray
+         * @param[in]  tmax  The maximum distance
+         *
+         * @return     Whether there was an intersection closer than tmax
+         */
+        bool Occluded(Ray &ray, Number_t tmax) const;
+
+        /**
+         * @brief      Computes the intersection of triangles bounding box and
+         *             the box in question
+         *             Note: A non empty intersection is assumed
+         *
+         * @param      t     Triangle
+         * @param[in]  V     Containing box
+         *
+         * @return     Non empty intersection of the two boxes
+         */
+        static Box clipTriangleToBox(const Triangle *t, const Box &V);
+
+        /**
+         * @brief      Computes the bounding box of the part of a triangle
+         *             inside the box in question
+         *
+         * @details    Clips the triangle polygon against the six planes of
+         *             V (Sutherland-Hodgman). Falls back to
+         *             clipTriangleToBox when nothing is left
+         *
+         * @param      t     Triangle
+         * @param[in]  V     Containing box
+         *
+         * @return     Bounds of the clipped polygon, inside V
+         */
+        static Box clipPolygonToBox(const Triangle *t, const Box &V);
 };
 }  // namespace RayTracerxx
 
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <iostream>
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Progress messages of loading, building and rendering
+ *
+ * @details    Messages go to stderr, so stdout only carries what commands
+ *             were asked for (previews, reports). A message above the
+ *             verbosity goes to a stream without buffer, whose failed state
+ *             makes every << return before formatting anything, so a quiet
+ *             run pays no console I/O
+ */
+class Log {
+public:
+        enum Level {
+                QUIET  = 0,  // errors only, they always go to std::cerr
+                INFO   = 1,  // build and render timings (default)
+                DETAIL = 2   // ply headers, bounding boxes, node counts
+        };
+
+        /**
+         * @brief      Sets which messages are shown
+         *
+         * @param[in]  level  The highest level shown
+         */
+        static void setVerbosity(Level level) { verbosity() = level; }
+
+        /**
+         * @brief      Checks whether messages of a level are shown
+         */
+        static bool enabled(Level level) { return level <= verbosity(); }
+
+        /**
+         * @brief      Gets the stream of a level
+         *
+         * @param[in]  level  The level of the message
+         *
+         * @return     std::cerr, or a stream discarding the message
+         */
+        static std::ostream &out(Level level = INFO) {
+                static std::ostream discard(NULL);
+                return enabled(level) ? std::cerr : discard;
+        }
+
+private:
+        static Level &verbosity() {
+                static Level level = INFO;
+                return level;
+        }
+};
+}  // namespace RayTracerxx
+#endif
@@ -0,0 +1,272 @@
+#include "PerfCounters.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace RayTracerxx {
+
+namespace {
+
+#ifdef __linux__
+struct EventConfig {
+        uint32_t type;
+        uint64_t config;
+};
+
+// indexed by PerfCounters::Event
+const EventConfig eventConfigs[PerfCounters::NUM_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},  // last level cache
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}};
+#endif
+
+/**
+ * @brief      Counters of the calling thread, opened as one perf event
+ *             group so that they are read with a single system call
+ */
+struct ThreadCounters {
+        int                 leader;
+        int                 fds[PerfCounters::NUM_EVENTS];
+        int                 position[PerfCounters::NUM_EVENTS];  // in a read
+        unsigned            numOpen;
+        bool                opened;
+        int                 error;  // errno of the first event that failed
+        PerfCounters::Phase phase;
+        unsigned long long  last[PerfCounters::NUM_EVENTS];
+        std::chrono::steady_clock::time_point lastTime;
+
+        ThreadCounters()
+            : leader(-1),
+              numOpen(0),
+              opened(false),
+              error(0),
+              phase(PerfCounters::NONE) {
+                std::fill_n(fds, PerfCounters::NUM_EVENTS, -1);
+                std::fill_n(position, PerfCounters::NUM_EVENTS, -1);
+                std::fill_n(last, PerfCounters::NUM_EVENTS, 0);
+        }
+
+        ~ThreadCounters() {
+#ifdef __linux__
+                for (int fd : fds)
+                        if (fd >= 0)
+                                close(fd);
+#endif
+        }
+
+        /**
+         * @brief      Opens every event the kernel accepts, counting user
+         *             space only
+         */
+        void open() {
+                opened = true;
+#ifdef __linux__
+                for (int e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+                        perf_event_attr attr;
+                        std::memset(&attr, 0, sizeof(attr));
+                        attr.size           = sizeof(attr);
+                        attr.type           = eventConfigs[e].type;
+                        attr.config         = eventConfigs[e].config;
+                        attr.exclude_kernel = 1;
+                        attr.exclude_hv     = 1;
+                        attr.read_format    = PERF_FORMAT_GROUP |
+                                           PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                        int fd = syscall(SYS_perf_event_open, &attr, 0, -1,
+                                         leader, 0);
+                        if (fd < 0) {
+                                error = error != 0 ? error : errno;
+                                continue;
+                        }
+                        if (leader < 0)
+                                leader = fd;
+                        fds[e]      = fd;
+                        position[e] = numOpen++;
+                }
+#else
+                error = ENOSYS;
+#endif
+        }
+
+        /**
+         * @brief      Reads the counts since the events were opened, scaled
+         *             up if the kernel had to multiplex the group
+         */
+        void read(unsigned long long values[PerfCounters::NUM_EVENTS]) {
+                std::fill_n(values, PerfCounters::NUM_EVENTS, 0);
+#ifdef __linux__
+                // nr, time enabled, time running, one value per event
+                uint64_t buffer[3 + PerfCounters::NUM_EVENTS];
+                if (leader < 0 or
+                    ::read(leader, buffer, sizeof(buffer)) <
+                        ssize_t((3 + numOpen) * sizeof(uint64_t)))
+                        return;
+
+                double scale = buffer[2] > 0 ? double(buffer[1]) / buffer[2]
+                                             : 0;
+                for (int e = 0; e < PerfCounters::NUM_EVENTS; e++)
+                        if (position[e] >= 0)
+                                values[e] = buffer[3 + position[e]] * scale;
+#endif
+        }
+};
+
+thread_local ThreadCounters self;
+
+}  // namespace
+
+PerfCounters::Slot::Slot() {
+        std::fill_n(&seconds[0], NUM_PHASES, 0);
+        std::fill_n(&counts[0][0], NUM_PHASES * NUM_EVENTS, 0);
+}
+
+PerfCounters &PerfCounters::instance() {
+        static PerfCounters counters;
+        return counters;
+}
+
+PerfCounters::~PerfCounters() {
+        for (Slot *s : slots)
+                delete s;
+}
+
+void PerfCounters::enable(bool on) {
+        counting = on;
+        if (not on)
+                return;
+
+        if (not self.opened)
+                self.open();
+        numEvents = self.numOpen;
+        for (int e = 0; e < NUM_EVENTS; e++)
+                available[e] = self.fds[e] >= 0;
+
+        if (numEvents == 0) {
+                reason = std::strerror(self.error);
+                std::cerr << "Hardware counters unavailable (" << reason
+                          << "), only timing phases\n";
+        }
+}
+
+void PerfCounters::reset(unsigned numThreads) {
+        for (Slot *s : slots)
+                delete s;
+        slots.clear();
+        for (unsigned i = 0; i < numThreads; i++)
+                slots.push_back(new Slot());
+}
+
+PerfCounters::Phase PerfCounters::currentPhase() { return self.phase; }
+
+PerfCounters::Phase PerfCounters::switchPhase(Phase phase) {
+        using namespace std::chrono;
+
+        if (numEvents > 0 and not self.opened)
+                self.open();
+
+        unsigned long long values[NUM_EVENTS];
+        self.read(values);
+        steady_clock::time_point now = steady_clock::now();
+
+        unsigned s = ThreadPool::currentSlot();
+        if (self.phase != NONE and s < slots.size()) {
+                Slot &slot = *slots[s];
+                slot.seconds[self.phase] +=
+                    duration<double>(now - self.lastTime).count();
+                for (int e = 0; e < NUM_EVENTS; e++)
+                        if (values[e] > self.last[e])
+                                slot.counts[self.phase][e] +=
+                                    values[e] - self.last[e];
+        }
+
+        Phase previous = self.phase;
+        std::copy_n(values, NUM_EVENTS, self.last);
+        self.lastTime = now;
+        self.phase    = phase;
+        return previous;
+}
+
+double PerfCounters::seconds(Phase phase) const {
+        double total = 0;
+        for (const Slot *s : slots)
+                total += s->seconds[phase];
+        return total;
+}
+
+long long PerfCounters::count(Phase phase, Event event) const {
+        if (numEvents == 0 or not available[event])
+                return -1;
+
+        long long total = 0;
+        for (const Slot *s : slots)
+                total += s->counts[phase][event];
+        return total;
+}
+
+/**
+ * @brief      Seconds are thread time, i.e. summed over the threads that
+ *             worked on the phase
+ */
+void PerfCounters::print(std::ostream &out, Phase first, Phase last) const {
+        const char *phases[NUM_PHASES] = {"build", "primary", "shadow",
+                                          "shading"};
+        const char *events[NUM_EVENTS] = {"cycles", "instructions",
+                                          "LLC misses", "branch misses",
+                                          "dTLB misses"};
+        std::streamsize precision = out.precision();
+
+        out << "  " << std::left << std::setw(9) << "phase" << std::right
+            << std::setw(10) << "seconds";
+        if (hardware()) {
+                for (const char *name : events)
+                        out << std::setw(15) << name;
+                out << std::setw(7) << "IPC";
+        }
+        out << "\n";
+
+        for (int p = first; p <= last; p++) {
+                out << "  " << std::left << std::setw(9) << phases[p]
+                    << std::right << std::setw(10) << std::fixed
+                    << std::setprecision(3) << seconds(Phase(p));
+                if (hardware()) {
+                        for (int e = 0; e < NUM_EVENTS; e++) {
+                                long long n = count(Phase(p), Event(e));
+                                if (n < 0)
+                                        out << std::setw(15) << "-";
+                                else
+                                        out << std::setw(15) << n;
+                        }
+                        long long cycles = count(Phase(p), CYCLES);
+                        long long instrs = count(Phase(p), INSTRUCTIONS);
+                        if (cycles > 0 and instrs >= 0)
+                                out << std::setw(7) << std::setprecision(2)
+                                    << double(instrs) / cycles;
+                        else
+                                out << std::setw(7) << "-";
+                }
+                out << "\n";
+        }
+        if (not hardware())
+                out << "  (hardware counters unavailable: " << reason
+                    << ")\n";
+        out.unsetf(std::ios::floatfield);
+        out.precision(precision);
+}
+
+}  // namespace RayTracerxx
@@ -0,0 +1,166 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Hardware performance counters (Linux perf_event_open) and
+ *             thread time, attributed to the phases of a render
+ *
+ * @details    Every thread counts its own user space events. A thread is in
+ *             at most one phase at a time: switching phases reads the
+ *             thread's counters once and adds what was counted since the
+ *             previous switch to the phase being left. ThreadPool tasks run
+ *             in the phase of the thread that queued them, so the work of a
+ *             parallel build is attributed to the build.
+ *
+ *             Totals are kept in one slot per ThreadPool thread, so
+ *             recording takes no lock. When the counters cannot be opened
+ *             (no permission, virtual machines, other systems) only the time
+ *             spent in every phase is reported.
+ */
+class PerfCounters {
+public:
+        enum Phase { NONE = -1, BUILD = 0, PRIMARY, SHADOW, SHADING, NUM_PHASES };
+        enum Event {
+                CYCLES = 0,
+                INSTRUCTIONS,
+                LLC_MISSES,
+                BRANCH_MISSES,
+                DTLB_MISSES,
+                NUM_EVENTS
+        };
+
+        /**
+         * @brief      Gets the process wide counters
+         *
+         * @return     The counters
+         */
+        static PerfCounters &instance();
+
+        /**
+         * @brief      Turns the instrumentation on or off
+         *
+         * @details    Turning it on checks which events the calling thread can
+         *             open, and reports the reason if there are none
+         *
+         * @param[in]  on    Whether phases are counted
+         */
+        void enable(bool on);
+
+        /**
+         * @brief      Checks whether phases are counted
+         */
+        bool enabled() const { return counting; }
+
+        /**
+         * @brief      Checks whether hardware events are counted, or only time
+         */
+        bool hardware() const { return numEvents > 0; }
+
+        /**
+         * @brief      Clears the totals, with one slot per thread
+         *
+         * @details    Must not be called while phases are being counted
+         *
+         * @param[in]  numThreads  Size of the ThreadPool
+         */
+        void reset(unsigned numThreads);
+
+        /**
+         * @brief      Gets the phase of the calling thread
+         */
+        static Phase currentPhase();
+
+        /**
+         * @brief      Moves the calling thread to another phase
+         *
+         * @param[in]  phase  The new phase
+         *
+         * @return     The phase the thread was in
+         */
+        Phase switchPhase(Phase phase);
+
+        /**
+         * @brief      Gets the time spent in a phase, summed over threads
+         *
+         * @return     Seconds
+         */
+        double seconds(Phase phase) const;
+
+        /**
+         * @brief      Gets the number of events counted in a phase, summed
+         *             over threads
+         *
+         * @return     The count, or -1 if the event is not available
+         */
+        long long count(Phase phase, Event event) const;
+
+        /**
+         * @brief      Prints one row per phase in [first, last]
+         *
+         * @param      out    The stream
+         * @param[in]  first  First phase
+         * @param[in]  last   Last phase
+         */
+        void print(std::ostream &out, Phase first, Phase last) const;
+
+        ~PerfCounters();
+
+private:
+        /**
+         * @brief      Totals of one thread. Padded so that two slots do not
+         *             share a cache line
+         */
+        struct Slot {
+                double             seconds[NUM_PHASES];
+                unsigned long long counts[NUM_PHASES][NUM_EVENTS];
+                char               padding[64];
+                Slot();
+        };
+
+        PerfCounters() : counting(false), numEvents(0), available() {}
+        PerfCounters(const PerfCounters &) = delete;
+        PerfCounters &operator=(const PerfCounters &) = delete;
+
+        bool                counting;
+        unsigned            numEvents;  // events the enabling thread opened
+        bool                available[NUM_EVENTS];
+        std::string         reason;  // why no event could be opened
+        std::vector<Slot *> slots;
+};
+
+/**
+ * @brief      Counts the lifetime of the object in a phase, then returns the
+ *             thread to the phase it was in
+ */
+class PerfScope {
+public:
+        explicit PerfScope(PerfCounters::Phase phase) {
+                active = PerfCounters::instance().enabled() and
+                         phase != PerfCounters::currentPhase();
+                if (active)
+                        previous = PerfCounters::instance().switchPhase(phase);
+        }
+
+        ~PerfScope() {
+                if (active)
+                        PerfCounters::instance().switchPhase(previous);
+        }
+
+private:
+        PerfScope(const PerfScope &) = delete;
+        PerfScope &operator=(const PerfScope &) = delete;
+
+        bool                active;
+        PerfCounters::Phase previous;
+};
+
+}  // namespace RayTracerxx
+
+#endif
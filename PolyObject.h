@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 #include "Box.h"
+#include "Log.h"
 #include "ray.h"
 #include <math.h>
 #include <algorithm>
@@ -11,23 +12,113 @@
 #include <climits>
 #include "OrderedList.h"
 #include "PolyObject.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include "rgb.h"
 
 #include <fstream>
+#include <unordered_map>
 #include "./tinyply/source/tinyply.h"
 namespace RayTracerxx {
 
+/**
+ * @brief      What the intersection test needs of a triangle: the first
+ *             vertex and the two edges leaving it, precomputed
+ *
+ * @details    KDTree keeps one record per triangle in a cache line aligned
+ *             array of its own, so every test reads exactly one cache line
+ *             instead of following a pointer to a 104 bytes Triangle, whose
+ *             normal and material are only needed for shading the final
+ *             hit. The edges are stored as floats to fit the line: v0 stays
+ *             a double, so the rounding is relative to the size of the
+ *             triangle, not to its distance from the origin
+ */
+struct alignas(64) TriAccel {
+        Point<3> v0;
+        float    edge1[3];  // v1 - v0
+        float    edge2[3];  // v2 - v0
+
+        TriAccel() : v0{0, 0, 0}, edge1{0, 0, 0}, edge2{0, 0, 0} {}
+
+        TriAccel(const Point<3>& p0, const Point<3>& p1, const Point<3>& p2)
+            : v0(p0) {
+                for (int k = 0; k < 3; k++) {
+                        edge1[k] = p1[k] - p0[k];
+                        edge2[k] = p2[k] - p0[k];
+                }
+        }
+
+        // Möller–Trumbore intersection algorithm
+        // http://webserver2.tecgraf.puc-rio.br/~mgattass/cg/trbRR/
+        // Fast%20MinimumStorage%20RayTriangle%20Intersection.pdf
+        //
+        // Returns whether the triangle is hit closer than tracer.t, which is
+        // then updated. Setting tracer.hit is left to the caller
+        bool Intersect(Ray& tracer) const {
+                const Number_t EPSILON = 0.0000001;
+                Vector<3>      e1{edge1[0], edge1[1], edge1[2]};
+                Vector<3>      e2{edge2[0], edge2[1], edge2[2]};
+                Vector<3>      h = tracer.direction.cross(e2);
+                Number_t       a = e1.dot(h);
+                if (a > -EPSILON && a < EPSILON)
+                        return false;  // This ray is parallel to this triangle.
+                Number_t  f = 1.0 / a;
+                Vector<3> s = tracer.origin - v0;
+                Number_t  u = f * (s.dot(h));
+                if (u < 0.0 || u > 1.0)
+                        return false;
+                Vector<3> q = s.cross(e1);
+                Number_t  v = f * tracer.direction.dot(q);
+                if (v < 0.0 || u + v > 1.0)
+                        return false;
+                // At this stage we can compute t to find out where the
+                // intersection point is on the line. A t below EPSILON is a
+                // line intersection but not a ray intersection
+                Number_t t = f * e2.dot(q);
+                if (t <= EPSILON || t >= tracer.t)
+                        return false;
+                tracer.t = t;
+                return true;
+        }
+};
+static_assert(sizeof(TriAccel) == 64, "TriAccel must fill one cache line");
+
+/**
+ * @brief      Shading attributes, shared by the triangles of an object that
+ *             have the same color
+ */
+struct Material {
+        RGB      color;
+        Number_t ks;
+        Number_t kd;
+        RGB      ka;
+
+        Material() { setColor(127, 127, 127); }
+
+        Material(Number_t r, Number_t g, Number_t b) { setColor(r, g, b); }
+
+        void setColor(Number_t r, Number_t g, Number_t b) {
+                color.setRGB(r, g, b);
+                ka = color * (1 / 10.0);
+                kd = 1;
+                ks = 1;
+        }
+};
+
+/**
+ * @brief      Geometry of a triangle. Its shading attributes are in the
+ *             material table of its object, or of the Scene once the object
+ *             is added to one
+ */
 struct Triangle {
         Point<3>  vertex[3];
         Vector<3> normal;
-        RGB       color;
-        Number_t  ks;
-        Number_t  kd;
-        RGB       ka;
+        uint32_t  material;  // index in the material table
 
-        Triangle() : vertex{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}}, normal{0, 0, 0} {
-                setColor(127, 127, 127);
-        }
+        Triangle()
+            : vertex{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}},
+              normal{0, 0, 0},
+              material(0) {}
 
         Triangle(const Point<3>& p, const Point<3>& p2, const Point<3>& p3)
             : Triangle() {
@@ -48,13 +139,6 @@ struct Triangle {
                 normal.normalize();
         }
 
-        void setColor(Number_t r, Number_t g, Number_t b) {
-                color.setRGB(r, g, b);
-                ka = color * (1 / 10.0);
-                kd = 1;
-                ks = 1;
-        }
-
         Box CalcBounds() const {
                 Number_t xMax, yMax, zMax, xMin, yMin, zMin;
                 using std::max;
@@ -75,37 +159,17 @@ struct Triangle {
                        vertex[2] == t.vertex[2];
         }
 
-        // Möller–Trumbore intersection algorithm
-        // http://webserver2.tecgraf.puc-rio.br/~mgattass/cg/trbRR/
-        // Fast%20MinimumStorage%20RayTriangle%20Intersection.pdf
-        void Intersect(Ray& tracer) {
-                const Number_t EPSILON = 0.0000001;
-                Vector<3>      edge1   = vertex[1] - vertex[0];
-                Vector<3>      edge2   = vertex[2] - vertex[0];
-                Vector<3>      h       = tracer.direction.cross(edge2);
-                Number_t       a       = edge1.dot(h);
-                if (a > -EPSILON && a < EPSILON)
-                        return;  // This ray is parallel to this triangle.
-                Number_t  f = 1.0 / a;
-                Vector<3> s = tracer.origin - vertex[0];
-                Number_t  u = f * (s.dot(h));
-                if (u < 0.0 || u > 1.0)
-                        return;
-                Vector<3> q = s.cross(edge1);
-                Number_t  v = f * tracer.direction.dot(q);
-                if (v < 0.0 || u + v > 1.0)
-                        return;
-                // At this stage we can compute t to find out where the
-                // intersection point is on the line.
-                Number_t t = f * edge2.dot(q);
-                if (t > EPSILON)  // ray intersection
-                {
-                        tracer.hit = (t < tracer.t) ? this : tracer.hit;
-                        tracer.t   = (t < tracer.t) ? t : tracer.t;
-                        return;
-                } else  // This means that there is a line intersection but not
-                        // a ray intersection.
-                        return;
+        /**
+         * @brief      Gets the intersection record of the triangle
+         */
+        TriAccel accel() const {
+                return TriAccel(vertex[0], vertex[1], vertex[2]);
+        }
+
+        // Records a hit closer than tracer.t (see TriAccel::Intersect)
+        void Intersect(Ray& tracer) const {
+                if (accel().Intersect(tracer))
+                        tracer.hit = this;
         }
 };
 }  // namespace RayTracerxx
@@ -128,7 +192,7 @@ static void getProperties(std::vector<float>&    verts,
                           std::vector<uint8_t>&  color,
                           std::vector<uint32_t>& f, std::string filename) {
         using namespace tinyply;
-        (void)color;
+        TraceScope trace("getProperties");
         try {
                 std::ifstream ss(filename, std::ios::binary);
                 if (ss.fail())
@@ -137,26 +201,27 @@ static void getProperties(std::vector<float>&    verts,
                 PlyFile file;
                 file.parse_header(ss);
 
-                std::cout << "................................................"
-                             "........................\n";
+                std::ostream& log = Log::out(Log::DETAIL);
+                log << "................................................"
+                       "........................\n";
                 for (auto c : file.get_comments())
-                        std::cout << "Comment: " << c << std::endl;
+                        log << "Comment: " << c << "\n";
                 for (auto e : file.get_elements()) {
-                        std::cout << "element - " << e.name << " (" << e.size
-                                  << ")" << std::endl;
+                        log << "element - " << e.name << " (" << e.size
+                            << ")\n";
                         for (auto p : e.properties)
-                                std::cout
-                                    << "\tproperty - " << p.name << " ("
+                                log << "\tproperty - " << p.name << " ("
                                     << tinyply::PropertyTable[p.propertyType]
                                            .str
-                                    << ")" << std::endl;
+                                    << ")\n";
                 }
-                std::cout << "................................................"
-                             "........................\n";
+                log << "................................................"
+                       "........................\n";
 
                 // Tinyply treats parsed data as untyped byte buffers. See
                 // below for examples.
-                std::shared_ptr<PlyData> vertices, normals, faces, texcoords;
+                std::shared_ptr<PlyData> vertices, normals, faces, texcoords,
+                    colors;
 
                 // The header information can be used to programmatically
                 // extract properties on elements known to exist in the header
@@ -188,6 +253,15 @@ static void getProperties(std::vector<float>&    verts,
                                   << std::endl;
                 }
 
+                // face colors are optional, uncolored faces get the default
+                // material
+                try {
+                        colors = file.request_properties_from_element(
+                            "face", {"red", "green", "blue"});
+                } catch (const std::exception& e) {
+                        log << "No face colors: " << e.what() << "\n";
+                }
+
                 // manual_timer read_timer;
 
                 // read_timer.start();
@@ -202,8 +276,8 @@ static void getProperties(std::vector<float>&    verts,
                 // std::cout << "\tRead " << texcoords->count << " total vertex
                 // texcoords " << std::endl;
                 if (faces)
-                        std::cout << "\tRead " << faces->count
-                                  << " total faces (triangles) " << std::endl;
+                        log << "\tRead " << faces->count
+                            << " total faces (triangles)\n";
 
                 // type casting to your own native types - Option B
                 {
@@ -222,6 +296,13 @@ static void getProperties(std::vector<float>&    verts,
                         f.assign(tmp2, tmp2 + faces->buffer.size_bytes() /
                                                   sizeof(tmp2[0]));
                 }
+                if (colors and colors->t == tinyply::Type::UINT8) {
+                        const uint8_t* tmp = colors->buffer.get();
+                        color.assign(tmp, tmp + colors->buffer.size_bytes());
+                } else if (colors) {
+                        std::cerr << "Ignoring face colors that are not uchar"
+                                  << std::endl;
+                }
 
         } catch (const std::exception& e) {
                 std::cerr << "Caught tinyply exception: " << e.what()
@@ -241,39 +322,94 @@ static void getVertices(size_t i, const std::vector<uint32_t>& faces,
         }
 }
 
-static void setColors(Triangle& toRender, int i, std::vector<uint8_t>& color) {
-        if (color.size() != 0)
-                toRender.color.setRGB(color[i * 3], color[i * 3 + 1],
-                                      color[i * 3 + 2]);
+/**
+ * @brief      Gives every triangle the material of its face color, adding
+ *             one material per distinct color
+ *
+ * @param      mesh       The triangles
+ * @param      materials  The material table (output parameter)
+ * @param[in]  color      Red, green and blue of every face
+ */
+static void setColors(std::vector<Triangle>& mesh,
+                      std::vector<Material>& materials,
+                      const std::vector<uint8_t>& color) {
+        std::unordered_map<uint32_t, uint32_t> index;  // packed color
+        for (size_t i = 0; i < mesh.size() and 3 * i + 2 < color.size(); i++) {
+                uint32_t key = color[3 * i] << 16 | color[3 * i + 1] << 8 |
+                               color[3 * i + 2];
+                auto found = index.find(key);
+                if (found == index.end()) {
+                        found = index.emplace(key, materials.size()).first;
+                        materials.push_back(Material(
+                            color[3 * i], color[3 * i + 1], color[3 * i + 2]));
+                }
+                mesh[i].material = found->second;
+        }
 }
 
 struct PolyObject {
         std::vector<Triangle> mesh;
+        std::vector<Material> materials;  // indexed by Triangle::material
         Box                   bbox;
 
         PolyObject(const std::string& filename) { read_ply_file(filename); }
 
+        /**
+         * @brief      Reads the mesh of a ply file
+         *
+         * @details    Triangles are constructed in parallel chunks on the
+         *             ThreadPool. Each chunk computes the bounds of its
+         *             triangles, which are then combined into bbox
+         *
+         * @param[in]  filename  The filename
+         */
         void read_ply_file(const std::string& filename) {
                 using namespace tinyply;
-                Number_t hi[3], lo[3];
-                hi[0] = hi[1] = hi[2] = -Ray::Infinity;
-                lo[0] = lo[1] = lo[2] = Ray::Infinity;
+                constexpr size_t grain = 1 << 14;  // triangles per task
 
                 std::vector<float>    verts;
                 std::vector<uint8_t>  color;
                 std::vector<uint32_t> faces;
-                Point<3>              tri[3];
 
                 getProperties(verts, color, faces, filename);
-                mesh.reserve(faces.size() / 3);
-                for (size_t i = 0; i < faces.size() / 3; i++) {
-                        getVertices(i, faces, verts, tri);
-                        bounds(lo, hi, tri);
-                        mesh.emplace_back(tri[0], tri[1], tri[2]);
-                        setColors(mesh.back(), i, color);
+
+                size_t numTris   = faces.size() / 3;
+                size_t numChunks = (numTris + grain - 1) / grain;
+                std::vector<Box> chunkBounds(numChunks);
+
+                TraceScope trace("triangles", "count", numTris);
+                mesh.resize(numTris);
+                parallelFor(0, numTris, grain, [&](size_t first, size_t last) {
+                        TraceScope chunk("triangle chunk", "first", first);
+                        Number_t hi[3], lo[3];
+                        Point<3> tri[3];
+                        hi[0] = hi[1] = hi[2] = -Ray::Infinity;
+                        lo[0] = lo[1] = lo[2] = Ray::Infinity;
+
+                        for (size_t i = first; i < last; i++) {
+                                getVertices(i, faces, verts, tri);
+                                bounds(lo, hi, tri);
+                                mesh[i] = Triangle(tri[0], tri[1], tri[2]);
+                        }
+                        chunkBounds[first / grain] =
+                            Box(hi[0], hi[1], hi[2], lo[0], lo[1], lo[2]);
+                });
+
+                Number_t hi[3], lo[3];
+                hi[0] = hi[1] = hi[2] = -Ray::Infinity;
+                lo[0] = lo[1] = lo[2] = Ray::Infinity;
+                for (const Box& b : chunkBounds) {
+                        for (int k = 0; k < 3; k++) {
+                                hi[k] = std::max(hi[k], b.hi[k]);
+                                lo[k] = std::min(lo[k], b.low[k]);
+                        }
                 }
                 bbox = Box(hi[0], hi[1], hi[2], lo[0], lo[1], lo[2]);
-                std::cout << bbox << "\n";
+                Log::out(Log::DETAIL) << bbox << "\n";
+
+                // material 0 is the default, face colors add their own
+                materials.assign(1, Material());
+                setColors(mesh, materials, color);
         }
 };
 }  // namespace RayTracerxx
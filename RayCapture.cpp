@@ -0,0 +1,104 @@
+#include "RayCapture.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace RayTracerxx {
+
+constexpr char RayCapture::magic[9];
+
+RayCapture &RayCapture::instance() {
+        static RayCapture capture;
+        return capture;
+}
+
+RayCapture::~RayCapture() {
+        for (Slot *s : slots)
+                delete s;
+}
+
+void RayCapture::start(const std::string &file) {
+        filename  = file;
+        capturing = true;
+}
+
+void RayCapture::reset(unsigned numThreads) {
+        for (Slot *s : slots)
+                delete s;
+        slots.clear();
+        for (unsigned i = 0; i < numThreads; i++)
+                slots.push_back(new Slot());
+}
+
+void RayCapture::record(CapturedRay::Kind kind, const Ray &ray, Number_t tmax,
+                        bool hit) {
+        unsigned self = ThreadPool::currentSlot();
+        if (self >= slots.size())
+                return;
+
+        CapturedRay r;
+        for (int k = 0; k < 3; k++) {
+                r.origin[k]    = ray.origin[k];
+                r.direction[k] = ray.direction[k];
+        }
+        r.tmax = tmax;
+        r.t    = kind == CapturedRay::PRIMARY and hit ? ray.t : Ray::Infinity;
+        r.kind = kind;
+        r.hit  = hit;
+        slots[self]->rays.push_back(r);
+}
+
+size_t RayCapture::write() const {
+        uint64_t count = 0;
+        for (const Slot *s : slots)
+                count += s->rays.size();
+
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        if (not out.is_open()) {
+                std::cerr << "Unable to open capture file: " << filename
+                          << "\n";
+                return 0;
+        }
+        out.write(magic, 8);
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (const Slot *s : slots)
+                out.write(reinterpret_cast<const char *>(s->rays.data()),
+                          s->rays.size() * sizeof(CapturedRay));
+
+        return out.good() ? count : 0;
+}
+
+bool RayCapture::load(const std::string &       file,
+                      std::vector<CapturedRay> &rays) {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        char          header[8];
+        uint64_t      count = 0;
+
+        in.read(header, 8);
+        in.read(reinterpret_cast<char *>(&count), sizeof(count));
+        if (not in or std::memcmp(header, magic, 8) != 0)
+                return false;
+
+        // the count must fit in the rest of the file, or a corrupt header
+        // would allocate whatever it says
+        std::streampos start = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::streamoff left = in.tellg() - start;
+        in.seekg(start);
+        if (not in or count > uint64_t(left) / sizeof(CapturedRay))
+                return false;
+
+        rays.resize(count);
+        in.read(reinterpret_cast<char *>(rays.data()),
+                count * sizeof(CapturedRay));
+        if (in.gcount() != std::streamsize(count * sizeof(CapturedRay))) {
+                rays.clear();
+                return false;
+        }
+        return true;
+}
+
+}  // namespace RayTracerxx
@@ -0,0 +1,129 @@
+#ifndef RAYCAPTURE_H
+#define RAYCAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ray.h"
+
+namespace RayTracerxx {
+
+/**
+ * @brief      A ray traced during a render, with the answer the KDTree gave
+ *
+ * @details    Stored as is in capture files (little endian, 72 bytes), after
+ *             the magic string and the number of rays
+ */
+struct CapturedRay {
+        enum Kind : uint32_t { PRIMARY = 0, SHADOW = 1 };
+
+        double   origin[3];
+        double   direction[3];
+        double   tmax;  // Ray::Infinity for primary rays
+        double   t;     // distance of the primary hit, Ray::Infinity if none
+        uint32_t kind;
+        uint32_t hit;  // primary ray hit something, or shadow ray occluded
+
+        Ray toRay() const { return Ray(origin, direction); }
+};
+
+/**
+ * @brief      Records the rays of a render into a binary file, for the
+ *             replayRays benchmark
+ *
+ * @details    Every thread of the ThreadPool records into its own slot, so
+ *             recording takes no lock. The file is written when the render
+ *             ends, and rewritten by every render while capturing
+ */
+class RayCapture {
+public:
+        static constexpr char magic[9] = "RTRAYS01";
+
+        /**
+         * @brief      Gets the process wide capture
+         *
+         * @return     The capture
+         */
+        static RayCapture &instance();
+
+        /**
+         * @brief      Starts capturing the rays of the next renders
+         *
+         * @param[in]  filename  Where the rays are written
+         */
+        void start(const std::string &filename);
+
+        /**
+         * @brief      Stops capturing
+         */
+        void stop() { capturing = false; }
+
+        /**
+         * @brief      Checks whether rays are being captured
+         */
+        bool enabled() const { return capturing; }
+
+        /**
+         * @brief      Drops the recorded rays, with one slot per thread
+         *
+         * @details    Must not be called while rays are being recorded
+         *
+         * @param[in]  numThreads  Size of the ThreadPool
+         */
+        void reset(unsigned numThreads);
+
+        /**
+         * @brief      Adds a traced ray to the calling thread's slot
+         *
+         * @param[in]  kind  Primary or shadow ray
+         * @param[in]  ray   The ray, after tracing
+         * @param[in]  tmax  The maximum distance of the query
+         * @param[in]  hit   The result of the query
+         */
+        void record(CapturedRay::Kind kind, const Ray &ray, Number_t tmax,
+                    bool hit);
+
+        /**
+         * @brief      Writes every recorded ray to the capture file
+         *
+         * @return     Number of rays written, 0 if the file could not be
+         *             written
+         */
+        size_t write() const;
+
+        /**
+         * @brief      Reads a capture file
+         *
+         * @param[in]  filename  The filename
+         * @param      rays      The rays (output parameter)
+         *
+         * @return     Whether the file is a valid capture, holding as many
+         *             rays as its header says
+         */
+        static bool load(const std::string &      filename,
+                         std::vector<CapturedRay> &rays);
+
+        ~RayCapture();
+
+private:
+        /**
+         * @brief      Rays of one thread. Padded so that two slots do not
+         *             share a cache line
+         */
+        struct Slot {
+                std::vector<CapturedRay> rays;
+                char                     padding[64];
+        };
+
+        RayCapture() : capturing(false) {}
+        RayCapture(const RayCapture &) = delete;
+        RayCapture &operator=(const RayCapture &) = delete;
+
+        bool                capturing;
+        std::string         filename;
+        std::vector<Slot *> slots;
+};
+
+}  // namespace RayTracerxx
+
+#endif
@@ -3,8 +3,14 @@
 #include <iostream>
 #include <vector>
 #include "Camera.h"
+#include "Log.h"
 #include "OrderedList.h"
+#include "PerfCounters.h"
+#include "RayCapture.h"
 #include "PolyObject.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "TraversalStats.h"
 #include "ray.h"
 #include "rgb.h"
 #define TESTING
@@ -15,6 +21,7 @@
 #endif
 #include <algorithm>
 #include <chrono>
+#include <numeric>
 
 namespace RayTracerxx {
 
@@ -25,11 +32,13 @@ namespace RayTracerxx {
 Scene::Scene(int width, int height) : camera(width, height) {
         tree            = NULL;
         hasBeenModified = false;
+        heatmap         = false;
 }
 
 Scene::Scene() {
         tree            = NULL;
         hasBeenModified = false;
+        heatmap         = false;
 }
 
 Scene::~Scene() {
@@ -51,51 +60,206 @@ void Scene::preview() {
 void Scene::renderScene(bool preview) {
         using namespace std::chrono;
 
-        if (hasBeenModified) {
-                std::cout << "Building tree\n";
-                auto start = high_resolution_clock::now();
-                buildTree();
-                auto end        = high_resolution_clock::now();
-                hasBeenModified = false;
-                std::cout << "Build time: "
-                          << duration_cast<seconds>(end - start).count()
-                          << " seconds\n";
-        }
-
-        std::cout << "Rendering...\n";
+        renderStats = RenderStats();
+        updateTree();
+
+        Log::out() << "Rendering...\n";
+        TraversalStats::instance().reset(ThreadPool::instance().size());
+        PerfCounters::instance().reset(ThreadPool::instance().size());
+        RayCapture::instance().reset(ThreadPool::instance().size());
+#ifdef RAYTRACER_STATS
+        if (heatmap)
+                traversalCost.assign(camera.getWidth() * camera.getHeight(),
+                                     0);
+        else
+                traversalCost.clear();
+#endif
         auto t1 = high_resolution_clock::now();
-        for (int y = 0; y < camera.getHeight(); y++) {
-                for (int x = 0; x < camera.getWidth(); x++) {
-                        Ray tracer = camera.getRay(x, y);
+        if (preview) {
+                for (int y = 0; y < camera.getHeight(); y++) {
+                        for (int x = 0; x < camera.getWidth(); x++) {
+                                Ray tracer = camera.getRay(x, y);
 
-                        if (tree != NULL && tree->Intersect(tracer)) {
-                                if (preview)
+                                if (tree != NULL && tree->Intersect(tracer))
                                         std::cout << "|";
                                 else
-                                        shade(tracer, camera.getPixel(x, y));
-
-                        } else {
-                                if (preview)
                                         std::cout << ".";
-                                else
-                                        camera.updatePixel(x, y, RGB(0, 0, 0));
                         }
-                }
-                if (preview)
                         std::cout << "\n";
-        }
+                }
+        } else
+                renderStats.shadowRays = renderTiles();
         auto t2 = high_resolution_clock::now();
 
-        std::cout << "Elapsed time: "
-                  << duration_cast<milliseconds>(t2 - t1).count()
-                  << " milliseconds\n";
+        renderStats.width         = camera.getWidth();
+        renderStats.height        = camera.getHeight();
+        renderStats.threads       = ThreadPool::instance().size();
+        renderStats.renderSeconds = duration<double>(t2 - t1).count();
+        renderStats.primaryRays =
+            size_t(camera.getWidth()) * camera.getHeight();
+        if (tree != NULL) {
+                renderStats.triangles = tree->numTriangles();
+                renderStats.nodes     = tree->numNodes();
+        }
+
+        Log::out() << "Elapsed time: "
+                   << duration_cast<milliseconds>(t2 - t1).count()
+                   << " milliseconds\n";
+        if (PerfCounters::instance().enabled() and not preview)
+                PerfCounters::instance().print(Log::out(),
+                                               PerfCounters::PRIMARY,
+                                               PerfCounters::SHADING);
+        if (RayCapture::instance().enabled() and not preview)
+                Log::out() << "Captured " << RayCapture::instance().write()
+                           << " rays\n";
+}
+
+void Scene::updateTree() {
+        using namespace std::chrono;
+
+        if (not hasBeenModified)
+                return;
+
+        Log::out() << "Building tree\n";
+        PerfCounters::instance().reset(ThreadPool::instance().size());
+        auto start = high_resolution_clock::now();
+        {
+                PerfScope phase(PerfCounters::BUILD);
+                buildTree();
+        }
+        auto end        = high_resolution_clock::now();
+        hasBeenModified = false;
+        renderStats.rebuilt      = true;
+        renderStats.buildSeconds = duration<double>(end - start).count();
+
+        Log::out() << "Build time: "
+                   << duration_cast<milliseconds>(end - start).count()
+                   << " milliseconds\n";
+        if (PerfCounters::instance().enabled())
+                PerfCounters::instance().print(Log::out(), PerfCounters::BUILD,
+                                               PerfCounters::BUILD);
+        if (Log::enabled(Log::INFO))
+                Log::out() << "SAH cost: " << tree->sahCost() << "\n";
+}
+
+const KDTree* Scene::getTree() {
+        updateTree();
+        return tree;
+}
+
+/**
+ * @brief      Each tile is a task of the ThreadPool, so threads that draw
+ *             cheap tiles (e.g. background) steal the remaining ones instead
+ *             of idling. Every pixel is computed exactly as in a serial
+ *             render, so the output does not depend on the number of threads.
+ */
+size_t Scene::renderTiles() {
+        const int tilesX   = (camera.getWidth() + tileSize - 1) / tileSize;
+        const int tilesY   = (camera.getHeight() + tileSize - 1) / tileSize;
+        const int numTiles = tilesX * tilesY;
+
+        // summed after the render, so the tiles share no counter
+        std::vector<size_t> shadowRays(numTiles, 0);
+        parallelFor(0, numTiles, 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                        TraceScope trace("tile", "index", i);
+                        int        x0 = (i % tilesX) * tileSize;
+                        int y0 = (i / tilesX) * tileSize;
+                        shadowRays[i] = renderTile(
+                            x0, y0, std::min(x0 + tileSize, camera.getWidth()),
+                            std::min(y0 + tileSize, camera.getHeight()));
+                }
+        });
+        return std::accumulate(shadowRays.begin(), shadowRays.end(),
+                               size_t(0));
+}
+
+/**
+ * @brief      The tile is rendered in three passes (primary rays, shadow
+ *             rays, shading), each counted as its own PerfCounters phase.
+ *             Every pixel goes through the same arithmetic as it would in a
+ *             single pass
+ */
+size_t Scene::renderTile(int x0, int y0, int x1, int y1) {
+        const int    width     = x1 - x0;
+        const int    numPixels = width * (y1 - y0);
+        const size_t numLights = lights.size();
+
+        std::vector<Ray>  rays;
+        std::vector<char> hits(numPixels, false);
+        rays.reserve(numPixels);
+        {
+                PerfScope phase(PerfCounters::PRIMARY);
+                for (int y = y0; y < y1; y++) {
+                        for (int x = x0; x < x1; x++) {
+                                rays.push_back(camera.getRay(x, y));
+                                Ray& tracer = rays.back();
+                                hits[rays.size() - 1] =
+                                    tree != NULL && tree->Intersect(tracer);
+                                if (RayCapture::instance().enabled())
+                                        RayCapture::instance().record(
+                                            CapturedRay::PRIMARY, tracer,
+                                            Ray::Infinity,
+                                            hits[rays.size() - 1]);
+#ifdef RAYTRACER_STATS
+                                TraversalStats::instance().record(
+                                    TraversalStats::PRIMARY, tracer.counters);
+#endif
+                        }
+                }
+        }
+
+        std::vector<ShadowRay>   shadows(numPixels * numLights);
+        std::vector<RayCounters> shadowCounters(numPixels);
+        size_t                   numShadowRays = 0;
+        {
+                PerfScope phase(PerfCounters::SHADOW);
+                for (int i = 0; i < numPixels; i++) {
+                        if (hits[i]) {
+                                traceShadows(rays[i], &shadows[i * numLights],
+                                             shadowCounters[i]);
+                                numShadowRays += numLights;
+                        }
+                }
+        }
+
+        PerfScope phase(PerfCounters::SHADING);
+        for (int i = 0; i < numPixels; i++) {
+                int x = x0 + i % width;
+                int y = y0 + i / width;
+                if (hits[i])
+                        shade(rays[i], &shadows[i * numLights],
+                              camera.getPixel(x, y));
+                else
+                        camera.updatePixel(x, y, RGB(0, 0, 0));
+#ifdef RAYTRACER_STATS
+                if (heatmap)
+                        traversalCost[x + y * camera.getWidth()] =
+                            rays[i].counters.cost() + shadowCounters[i].cost();
+#endif
+        }
+        return numShadowRays;
 }
 
 void Scene::addObject(PolyObject newObj) {
-        objects.push_back(newObj);
+        uint32_t base = materials.size();
+        if (base > 0)
+                for (Triangle& tri : newObj.mesh)
+                        tri.material += base;
+        materials.insert(materials.end(), newObj.materials.begin(),
+                         newObj.materials.end());
+        newObj.materials.clear();
+
+        objects.push_back(std::move(newObj));
         hasBeenModified = true;
 }
 
+void Scene::setBuildOptions(const KDTree::BuildOptions& opts) {
+        buildOptions = opts;
+        if (tree != NULL)
+                hasBeenModified = true;
+}
+
 void Scene::addLight(Light newLight) {
         lights.push_back(newLight);
         hasBeenModified = true;
@@ -108,16 +272,15 @@ void Scene::addLight(std::initializer_list<Number_t> newPos,
 }
 
 /**
- * @brief      Iterates through all the lights in the scene
- *             If the tracer ray has an unobstructed view of a light shader
- *             models are applied
+ * @brief      Casts a shadow ray from the hit point of tracer towards every
+ *             light in the scene
  *
- * @param      tracer  The tracer
- * @param      pixel   The pixel
+ * @param      tracer    The tracer
+ * @param      shadows   One result per light (output parameter)
+ * @param      counters  Sum of the counters of the shadow rays
  */
-void Scene::shade(Ray& tracer, RGB& pixel) {
-        pixel.setRGB(0, 0, 0);
-
+void Scene::traceShadows(Ray& tracer, ShadowRay* shadows,
+                         RayCounters& counters) {
         for (size_t i = 0; i < lights.size(); i++) {
                 // Move the intersection point away from triangle
                 Point<3> inter =
@@ -127,12 +290,40 @@ void Scene::shade(Ray& tracer, RGB& pixel) {
                 Ray       shadow(inter, toLight);
                 shadow.direction.normalize();
 
-                tree->Intersect(shadow);
-                if (Vector<3>(shadow.intersection() - shadow.origin).norm() >=
-                    toLight.norm()) {
-                        //     std::cerr<<"/";
-                        BlinnPhong(pixel, tracer, shadow.direction, lights[i]);
-                        diffuse(pixel, tracer, shadow.direction, lights[i]);
+                Number_t tmax        = toLight.norm();
+                shadows[i].occluded  = tree->Occluded(shadow, tmax);
+                shadows[i].direction = shadow.direction;
+                if (RayCapture::instance().enabled())
+                        RayCapture::instance().record(CapturedRay::SHADOW,
+                                                      shadow, tmax,
+                                                      shadows[i].occluded);
+#ifdef RAYTRACER_STATS
+                TraversalStats::instance().record(TraversalStats::SHADOW,
+                                                  shadow.counters);
+                counters += shadow.counters;
+#else
+                (void)counters;
+#endif
+        }
+}
+
+/**
+ * @brief      Iterates through all the lights in the scene
+ *             If the tracer ray has an unobstructed view of a light shader
+ *             models are applied
+ *
+ * @param      tracer   The tracer
+ * @param      shadows  The shadow rays traced by traceShadows
+ * @param      pixel    The pixel
+ */
+void Scene::shade(Ray& tracer, const ShadowRay* shadows, RGB& pixel) {
+        pixel.setRGB(0, 0, 0);
+
+        for (size_t i = 0; i < lights.size(); i++) {
+                Vector<3> toLight = shadows[i].direction;
+                if (not shadows[i].occluded) {
+                        BlinnPhong(pixel, tracer, toLight, lights[i]);
+                        diffuse(pixel, tracer, toLight, lights[i]);
                 }
 
                 for (unsigned j = 0; j < 3; j++) {
@@ -156,15 +347,16 @@ void Scene::BlinnPhong(RGB& pixel, Ray& tracer, Vector<3>& shadow,
         if (shadow.dot(tracer.hit->normal) <= 0)
                 return;
 
-        Triangle* hit = tracer.hit;
+        const Triangle* hit      = tracer.hit;
+        const Material& material = materials[hit->material];
 
         Vector<3> h = shadow - tracer.direction;
         h.normalize();
 
         Number_t BlinnTerm =
-            hit->ks * std::max(h.dot(hit->normal), (Number_t)0.0);
+            material.ks * std::max(h.dot(hit->normal), (Number_t)0.0);
 
-        pixel = pixel + (hit->color * light.intensity * BlinnTerm);
+        pixel = pixel + (material.color * light.intensity * BlinnTerm);
 }
 
 /**
@@ -179,8 +371,8 @@ void Scene::diffuse(RGB& pixel, Ray& tracer, Vector<3>& shadow, Light& light) {
         if (shadow.dot(tracer.hit->normal) <= 0)
                 return;
 
-        pixel = pixel + tracer.hit->color * light.intensity *
-                            shadow.dot(tracer.hit->normal);
+        pixel = pixel + materials[tracer.hit->material].color *
+                            light.intensity * shadow.dot(tracer.hit->normal);
 }
 
 /**
@@ -211,12 +403,13 @@ void Scene::buildTree() {
                 zMax = std::max(zMax, objects[i].bbox.hi[2]);
 
                 xMin = std::min(xMin, objects[i].bbox.low[0]);
-                yMin = std::min(xMin, objects[i].bbox.low[1]);
-                zMin = std::min(xMin, objects[i].bbox.low[2]);
+                yMin = std::min(yMin, objects[i].bbox.low[1]);
+                zMin = std::min(zMin, objects[i].bbox.low[2]);
         }
         if (tree != NULL)
                 delete tree;
-        tree = new KDTree(Box(xMax, yMax, zMax, xMin, yMin, zMin), tris);
+        tree = new KDTree(Box(xMax, yMax, zMax, xMin, yMin, zMin), tris,
+                          buildOptions);
 }
 
 }  // namespace RayTracerxx
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "Camera.h"
 #include "OrderedList.h"
 #include "PolyObject.h"
+#include "StatsReport.h"
 #include "ray.h"
 #include "rgb.h"
 #define TESTING
@@ -51,13 +52,33 @@ private:
                 void setColor(RGB& newIntensity) { intensity = newIntensity; }
         };
 
+        /**
+         * @brief      Result of the shadow ray towards one light
+         */
+        struct ShadowRay {
+                Vector<3> direction;  // normalized, towards the light
+                bool      occluded;
+        };
+
+        /**
+         * @brief      Traces the shadow rays of a hit point
+         *
+         * @param      tracer    The tracer
+         * @param      shadows   One result per light (output parameter)
+         * @param      counters  Sum of the counters of the shadow rays (only
+         *                       in stats builds)
+         */
+        void traceShadows(Ray& tracer, ShadowRay* shadows,
+                          RayCounters& counters);
+
         /**
          * @brief      Computes the correct color of a pixel in the screen
          *
-         * @param      tracer  The tracer
-         * @param      pixel   The pixel
+         * @param      tracer   The tracer
+         * @param      shadows  The shadow rays, one per light
+         * @param      pixel    The pixel
          */
-        void shade(Ray& tracer, RGB& pixel);
+        void shade(Ray& tracer, const ShadowRay* shadows, RGB& pixel);
 
         /**
          * @brief      Computes the contribution of the BlinnPhong shader
@@ -92,10 +113,43 @@ private:
          */
         void buildTree();
 
+        /**
+         * @brief      Rebuilds the KD-Tree if the scene has been modified
+         *             since the last build, and reports the build
+         */
+        void updateTree();
+
+        /**
+         * @brief      Shades every pixel of the camera screen, splitting the
+         *             screen into tiles that are rendered as ThreadPool tasks
+         *
+         * @return     Number of shadow rays traced
+         */
+        size_t renderTiles();
+
+        /**
+         * @brief      Shades the pixels in [x0, x1) x [y0, y1)
+         *
+         * @param[in]  x0    First column
+         * @param[in]  y0    First row
+         * @param[in]  x1    One past the last column
+         * @param[in]  y1    One past the last row
+         *
+         * @return     Number of shadow rays traced
+         */
+        size_t renderTile(int x0, int y0, int x1, int y1);
+
         std::vector<PolyObject> objects;
+        std::vector<Material>   materials;  // of all objects, in order
         std::vector<Light>      lights;
         KDTree*                 tree;
+        KDTree::BuildOptions    buildOptions;
         bool                    hasBeenModified;
+        bool                    heatmap;
+        std::vector<uint32_t>   traversalCost;  // per pixel, stats builds
+        RenderStats             renderStats;    // of the last render
+
+        static constexpr int tileSize = 32;  // width and height of a tile
 
 public:
         Scene();
@@ -126,10 +180,87 @@ public:
         /**
          * @brief      Adds an object to Scene.
          *
+         * @details    The material table of the object is moved to the end
+         *             of the scene's, and the material indices of its
+         *             triangles are offset to match
+         *
          * @param[in]  <unnamed>  PolyObject to add
          */
         void addObject(PolyObject);
 
+        /**
+         * @brief      Sets how the KD-Tree is built. The tree is rebuilt on
+         *             the next render
+         *
+         * @param[in]  opts  The build settings
+         */
+        void setBuildOptions(const KDTree::BuildOptions& opts);
+
+        /**
+         * @brief      Gets how the KD-Tree is built
+         *
+         * @return     The build settings
+         */
+        const KDTree::BuildOptions& getBuildOptions() const {
+                return buildOptions;
+        }
+
+        /**
+         * @brief      Gets the KD-Tree of the scene, rebuilding it first if
+         *             the scene has been modified
+         *
+         * @return     The tree, NULL if the scene has no objects
+         */
+        const KDTree* getTree();
+
+        /**
+         * @brief      Gets the material of a triangle of the scene
+         *
+         * @param[in]  tri   The triangle, as hit by a ray through getTree
+         *
+         * @return     The material
+         */
+        const Material& getMaterial(const Triangle& tri) const {
+                return materials[tri.material];
+        }
+
+        /**
+         * @brief      Sets whether renders keep the traversal cost of every
+         *             pixel (only in stats builds)
+         *
+         * @param[in]  enable  Whether to keep the cost
+         */
+        void setHeatmap(bool enable) { heatmap = enable; }
+
+        /**
+         * @brief      Checks whether renders keep the traversal cost of every
+         *             pixel
+         *
+         * @return     Whether the cost is kept
+         */
+        bool heatmapEnabled() const { return heatmap; }
+
+        /**
+         * @brief      Gets the traversal cost of every pixel of the last
+         *             render: nodes visited plus triangles tested by its
+         *             primary and shadow rays
+         *
+         * @return     One value per pixel, row by row. Empty unless
+         *             heatmaps are enabled
+         */
+        const std::vector<uint32_t>& getTraversalCost() const {
+                return traversalCost;
+        }
+
+        /**
+         * @brief      Gets what the last render or preview took, with the
+         *             build of the tree if it was rebuilt. The output file
+         *             and encode time are left to the caller
+         *
+         * @return     The timings and counts
+         */
+        const RenderStats& getRenderStats() const { return renderStats; }
+
         /**
          * @brief      Adds a light.
          *
@@ -0,0 +1,116 @@
+#include "StatsReport.h"
+#include <sys/resource.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Quotes a string for JSON, escaping control characters
+ */
+static std::string quote(const std::string &text) {
+        std::string result = "\"";
+        for (char c : text) {
+                switch (c) {
+                        case '"': result += "\\\""; break;
+                        case '\\': result += "\\\\"; break;
+                        case '\b': result += "\\b"; break;
+                        case '\f': result += "\\f"; break;
+                        case '\n': result += "\\n"; break;
+                        case '\r': result += "\\r"; break;
+                        case '\t': result += "\\t"; break;
+                        default:
+                                if (static_cast<unsigned char>(c) < 0x20) {
+                                        char code[7];
+                                        std::snprintf(code, sizeof(code),
+                                                      "\\u%04x", c);
+                                        result += code;
+                                } else {
+                                        result += c;
+                                }
+                }
+        }
+        return result + "\"";
+}
+
+/**
+ * @brief      Formats a number for JSON, which has no NaN or infinities:
+ *             they are written as null
+ */
+static std::string number(double x) {
+        if (not std::isfinite(x))
+                return "null";
+        std::ostringstream out;
+        out << x;
+        return out.str();
+}
+
+StatsReport &StatsReport::instance() {
+        static StatsReport report;
+        return report;
+}
+
+void StatsReport::start(const std::string &file) {
+        filename  = file;
+        recording = true;
+}
+
+bool StatsReport::write() const {
+        if (not recording)
+                return false;
+
+        std::ofstream out(filename.c_str());
+        if (not out.is_open()) {
+                std::cerr << "Unable to open stats file: " << filename << "\n";
+                return false;
+        }
+        print(out);
+        return bool(out);
+}
+
+void StatsReport::print(std::ostream &out) const {
+        out << "{\n  \"objects\": [";
+        for (size_t i = 0; i < objects.size(); i++) {
+                const ObjectStats &o = objects[i];
+                out << (i ? "," : "") << "\n    {\"file\": " << quote(o.file)
+                    << ", \"triangles\": " << o.triangles
+                    << ", \"load_seconds\": " << number(o.loadSeconds) << "}";
+        }
+        out << (objects.empty() ? "" : "\n  ") << "],\n  \"renders\": [";
+        for (size_t i = 0; i < renders.size(); i++) {
+                const RenderStats &r = renders[i];
+                out << (i ? "," : "") << "\n    {\"output\": "
+                    << quote(r.output) << ", \"width\": " << r.width
+                    << ", \"height\": " << r.height
+                    << ", \"threads\": " << r.threads
+                    << ", \"triangles\": " << r.triangles
+                    << ", \"nodes\": " << r.nodes
+                    << ", \"rebuilt\": " << (r.rebuilt ? "true" : "false")
+                    << ", \"build_seconds\": " << number(r.buildSeconds)
+                    << ", \"render_seconds\": " << number(r.renderSeconds)
+                    << ", \"primary_rays\": " << r.primaryRays
+                    << ", \"shadow_rays\": " << r.shadowRays
+                    << ", \"rays_per_second\": " << number(r.raysPerSecond())
+                    << ", \"encode_seconds\": " << number(r.encodeSeconds)
+                    << "}";
+        }
+        out << (renders.empty() ? "" : "\n  ")
+            << "],\n  \"peak_rss_bytes\": " << peakRSS() << "\n}\n";
+}
+
+size_t StatsReport::peakRSS() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+                return 0;
+#ifdef __APPLE__
+        return usage.ru_maxrss;  // bytes
+#else
+        return size_t(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+}
+
+}  // namespace RayTracerxx
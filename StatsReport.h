@@ -0,0 +1,116 @@
+#ifndef STATSREPORT_H
+#define STATSREPORT_H
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace RayTracerxx {
+
+/**
+ * @brief      What loading one ply file took
+ */
+struct ObjectStats {
+        std::string file;
+        size_t      triangles;
+        double      loadSeconds;
+};
+
+/**
+ * @brief      What one render took, filled in by Scene::renderScene and
+ *             completed by the caller that encodes the image
+ */
+struct RenderStats {
+        std::string output;  // the image file, empty for previews
+        unsigned    width, height, threads;
+        size_t      triangles;     // in the tree
+        size_t      nodes;         // of the tree
+        bool        rebuilt;       // the tree was built by this render
+        double      buildSeconds;  // 0 unless rebuilt
+        double      renderSeconds;
+        size_t      primaryRays, shadowRays;
+        double      encodeSeconds;  // writing the image file
+
+        RenderStats()
+            : width(0), height(0), threads(0), triangles(0), nodes(0),
+              rebuilt(false), buildSeconds(0), renderSeconds(0),
+              primaryRays(0), shadowRays(0), encodeSeconds(0) {}
+
+        /**
+         * @brief      Primary and shadow rays traced per second of render
+         */
+        double raysPerSecond() const {
+                return renderSeconds > 0
+                           ? (primaryRays + shadowRays) / renderSeconds
+                           : 0;
+        }
+};
+
+/**
+ * @brief      Machine readable report of a run, for dashboards: every object
+ *             loaded and every render, with the peak resident set size
+ *
+ * @details    The file is rewritten after every render and at exit, so it
+ *             is complete even if a later command crashes. Recording is
+ *             done by the main thread only
+ */
+class StatsReport {
+public:
+        /**
+         * @brief      Gets the process wide report
+         *
+         * @return     The report
+         */
+        static StatsReport &instance();
+
+        /**
+         * @brief      Starts recording into a JSON file
+         *
+         * @param[in]  filename  Where the report is written
+         */
+        void start(const std::string &filename);
+
+        /**
+         * @brief      Checks whether the run is being recorded
+         */
+        bool enabled() const { return recording; }
+
+        void addObject(const ObjectStats &object) { objects.push_back(object); }
+        void addRender(const RenderStats &render) { renders.push_back(render); }
+
+        /**
+         * @brief      Writes the report to the file given to start
+         *
+         * @return     Whether the file could be written
+         */
+        bool write() const;
+
+        /**
+         * @brief      Prints the report as a JSON object
+         *
+         * @param      out   The stream
+         */
+        void print(std::ostream &out) const;
+
+        /**
+         * @brief      Gets the peak resident set size of the process
+         *
+         * @return     The size in bytes, 0 if unknown
+         */
+        static size_t peakRSS();
+
+private:
+        StatsReport() : recording(false) {}
+        StatsReport(const StatsReport &) = delete;
+        StatsReport &operator=(const StatsReport &) = delete;
+
+        bool                     recording;
+        std::string              filename;
+        std::vector<ObjectStats> objects;
+        std::vector<RenderStats> renders;
+};
+
+}  // namespace RayTracerxx
+
+#endif
@@ -0,0 +1,332 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace RayTracerxx {
+
+// Slot of the calling thread. Threads the pool did not create use slot 0
+static thread_local unsigned thisSlot = 0;
+
+template <class T>
+static void count(std::atomic<T> &counter, T n) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+static long long nowNanoseconds() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(
+                   steady_clock::now().time_since_epoch())
+            .count();
+}
+
+/**
+ * @brief      Binds the calling thread to the slot-th CPU the process was
+ *             allowed to run on, or gives it back all of them
+ */
+static void pinThread(unsigned slot, bool pin) {
+#ifdef __linux__
+        // the first call comes from start(), before anything was pinned
+        static cpu_set_t allowed = [] {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                sched_getaffinity(0, sizeof(set), &set);
+                return set;
+        }();
+
+        cpu_set_t set = allowed;
+        if (pin) {
+                std::vector<int> cpus;
+                for (int c = 0; c < CPU_SETSIZE; c++)
+                        if (CPU_ISSET(c, &allowed))
+                                cpus.push_back(c);
+                CPU_ZERO(&set);
+                CPU_SET(cpus[slot % cpus.size()], &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)slot;
+        (void)pin;
+#endif
+}
+
+ThreadPool &ThreadPool::instance() {
+        static ThreadPool pool;
+        return pool;
+}
+
+ThreadPool::ThreadPool()
+    : queued(0), sleeping(0), stopping(false), statsEpoch(0),
+      pinThreads(false) {
+        slots.push_back(new Slot());
+}
+
+ThreadPool::~ThreadPool() {
+        stop();
+        for (Slot *s : slots)
+                delete s;
+}
+
+unsigned ThreadPool::currentSlot() {
+        return (thisSlot < instance().size()) ? thisSlot : 0;
+}
+
+void ThreadPool::start(unsigned numThreads, bool pin) {
+        stop();
+
+        if (numThreads == 0)
+                numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0)
+                numThreads = 1;
+
+        for (Slot *s : slots)
+                delete s;
+        slots.clear();
+        for (unsigned i = 0; i < numThreads; i++)
+                slots.push_back(new Slot());
+
+        stopping   = false;
+        thisSlot   = 0;
+        pinThreads = pin;
+        pinThread(0, pin);  // before the workers inherit its affinity
+        for (unsigned i = 1; i < numThreads; i++)
+                workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+void ThreadPool::stop() {
+        {
+                std::lock_guard<std::mutex> lk(sleepLock);
+                stopping = true;
+        }
+        wakeup.notify_all();
+
+        for (std::thread &t : workers)
+                t.join();
+        workers.clear();
+}
+
+std::vector<ThreadPool::WorkerStats> ThreadPool::stats() const {
+        const std::memory_order  relaxed = std::memory_order_relaxed;
+        std::vector<WorkerStats> result;
+        for (const Slot *s : slots) {
+                const Counters &c    = s->counters;
+                long long       idle = c.idleNanoseconds.load(relaxed);
+                if (long long since = s->idleSince)
+                        idle += idleNanosecondsSince(since);
+                result.push_back({c.executed.load(relaxed),
+                                  c.steals.load(relaxed), c.idle.load(relaxed),
+                                  idle * 1e-9});
+        }
+        return result;
+}
+
+void ThreadPool::resetStats() {
+        const std::memory_order relaxed = std::memory_order_relaxed;
+        statsEpoch                      = nowNanoseconds();
+        for (Slot *s : slots) {
+                s->counters.executed.store(0, relaxed);
+                s->counters.steals.store(0, relaxed);
+                s->counters.idle.store(0, relaxed);
+                s->counters.idleNanoseconds.store(0, relaxed);
+        }
+}
+
+long long ThreadPool::idleNanosecondsSince(long long since) const {
+        long long from = std::max<long long>(since, statsEpoch);
+        return std::max(0LL, nowNanoseconds() - from);
+}
+
+/**
+ * @brief      Sleeping workers are only notified when there are any, which
+ *             keeps the common case (everyone busy) free of the sleep lock.
+ *             A worker registers as sleeping before its final check of
+ *             queued, so a push is never missed.
+ */
+void ThreadPool::push(Task task) {
+        Slot *s = slots[currentSlot()];
+        {
+                std::lock_guard<std::mutex> lk(s->lock);
+                s->tasks.push_back(std::move(task));
+        }
+        queued++;
+
+        if (sleeping > 0) {
+                std::lock_guard<std::mutex> lk(sleepLock);
+                wakeup.notify_one();
+        }
+}
+
+/**
+ * @brief      Own tasks are taken from the back (most recently pushed),
+ *             stolen tasks from the front (oldest, usually the largest piece
+ *             of a recursive split)
+ */
+bool ThreadPool::pop(unsigned self, Task &out) {
+        if (queued == 0)
+                return false;
+
+        {
+                Slot *                      s = slots[self];
+                std::lock_guard<std::mutex> lk(s->lock);
+                if (not s->tasks.empty()) {
+                        out = std::move(s->tasks.back());
+                        s->tasks.pop_back();
+                        queued--;
+                        return true;
+                }
+        }
+
+        for (unsigned i = 1; i < slots.size(); i++) {
+                Slot *                      victim = slots[(self + i) % slots.size()];
+                std::lock_guard<std::mutex> lk(victim->lock);
+                if (not victim->tasks.empty()) {
+                        out = std::move(victim->tasks.front());
+                        victim->tasks.pop_front();
+                        queued--;
+                        count(slots[self]->counters.steals, 1ULL);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/**
+ * @brief      The group is signalled however the task ends, so that its
+ *             waiter never spins on a task that threw
+ */
+void ThreadPool::execute(unsigned self, Task &task) {
+        struct Done {
+                TaskGroup *group;
+                ~Done() { group->pending--; }
+        } done = {task.group};
+
+        try {
+                PerfScope phase(task.phase);
+                task.fn();
+        } catch (...) {
+                task.group->fail(std::current_exception());
+        }
+        count(slots[self]->counters.executed, 1ULL);
+}
+
+/**
+ * @brief      While asleep, a worker publishes when it fell asleep so that
+ *             stats() can count the wait before it ends
+ */
+void ThreadPool::workerLoop(unsigned self) {
+        thisSlot = self;
+        pinThread(self, pinThreads);
+
+        while (not stopping) {
+                Task task;
+                if (pop(self, task)) {
+                        execute(self, task);
+                        continue;
+                }
+
+                Slot *    slot  = slots[self];
+                long long start = nowNanoseconds();
+                count(slot->counters.idle, 1ULL);
+                slot->idleSince = start;
+                {
+                        std::unique_lock<std::mutex> lk(sleepLock);
+                        sleeping++;
+                        while (queued == 0 and not stopping)
+                                wakeup.wait(lk);
+                        sleeping--;
+                }
+                slot->idleSince = 0;
+                count(slot->counters.idleNanoseconds,
+                      idleNanosecondsSince(start));
+        }
+}
+
+void TaskGroup::run(std::function<void()> fn) {
+        pending++;
+        ThreadPool::instance().push(
+            {std::move(fn), this, PerfCounters::currentPhase()});
+}
+
+void TaskGroup::fail(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lk(errorLock);
+        if (not error)
+                error = e;
+}
+
+void TaskGroup::wait() {
+        waitAll();
+
+        // cleared first, so that the destructor does not throw it again
+        std::exception_ptr e;
+        {
+                std::lock_guard<std::mutex> lk(errorLock);
+                std::swap(e, error);
+        }
+        if (e)
+                std::rethrow_exception(e);
+}
+
+/**
+ * @brief      The waiting thread keeps executing tasks (of any group) so
+ *             that it contributes to the work it is waiting for
+ */
+void TaskGroup::waitAll() {
+        ThreadPool &          pool      = ThreadPool::instance();
+        unsigned              self      = ThreadPool::currentSlot();
+        ThreadPool::Counters &counters  = pool.slots[self]->counters;
+        bool                  idle      = false;
+        long long             idleStart = 0;
+
+        while (pending > 0) {
+                ThreadPool::Task task;
+                if (pool.pop(self, task)) {
+                        if (idle) {
+                                count(counters.idleNanoseconds,
+                                      pool.idleNanosecondsSince(idleStart));
+                                idle = false;
+                        }
+                        pool.execute(self, task);
+                } else {
+                        if (not idle) {
+                                idle      = true;
+                                idleStart = nowNanoseconds();
+                                count(counters.idle, 1ULL);
+                        }
+                        std::this_thread::yield();
+                }
+        }
+
+        if (idle)
+                count(counters.idleNanoseconds,
+                      pool.idleNanosecondsSince(idleStart));
+}
+
+void parallelFor(size_t begin, size_t end, size_t grain,
+                 const std::function<void(size_t, size_t)> &body) {
+        grain = std::max<size_t>(grain, 1);
+
+        if (ThreadPool::instance().size() == 1) {
+                for (size_t b = begin; b < end; b += grain)
+                        body(b, std::min(b + grain, end));
+                return;
+        }
+
+        TaskGroup group;
+        for (size_t b = begin; b < end; b += grain) {
+                size_t e = std::min(b + grain, end);
+                group.run([&body, b, e]() { body(b, e); });
+        }
+        group.wait();
+}
+
+}  // namespace RayTracerxx
@@ -0,0 +1,330 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "PerfCounters.h"
+
+namespace RayTracerxx {
+
+class TaskGroup;
+
+/**
+ * @brief      Process wide pool of worker threads with work stealing
+ *
+ * @details    The pool has one slot per thread. Slot 0 belongs to the thread
+ *             that called start() (the REPL thread), slots 1 to N - 1 are
+ *             background workers. Every slot owns a deque of tasks: a thread
+ *             pushes and pops its own tasks at the back (LIFO, good locality
+ *             for recursive work) and steals from the front of other slots
+ *             when its deque is empty.
+ *
+ *             Threads that wait on a TaskGroup execute tasks while waiting,
+ *             so tasks may spawn and wait on nested groups without
+ *             deadlocking the pool.
+ *
+ *             Until start() is called (e.g. in unit tests), the pool has a
+ *             single slot and every task runs on the thread that waits on
+ *             it.
+ */
+class ThreadPool {
+public:
+        /**
+         * @brief      Counters kept by every slot of the pool
+         */
+        struct WorkerStats {
+                unsigned long long executed;  // tasks run by this thread
+                unsigned long long steals;    // tasks taken from other slots
+                unsigned long long idle;      // times no task could be found
+                double             idleSeconds;  // time spent without work
+        };
+
+        /**
+         * @brief      Gets the process wide pool
+         *
+         * @return     The pool
+         */
+        static ThreadPool &instance();
+
+        /**
+         * @brief      (Re)starts the pool with the requested number of threads
+         *
+         * @details    The calling thread becomes slot 0. Must not be called
+         *             while tasks are running. Pinned threads are each bound
+         *             to one CPU, slot i to the i-th CPU the process may run
+         *             on (Linux only, elsewhere pin is ignored)
+         *
+         * @param[in]  numThreads  Number of threads (including the calling
+         *                         thread). 0 selects the hardware concurrency
+         * @param[in]  pin         Whether to pin the threads to CPUs
+         */
+        void start(unsigned numThreads = 0, bool pin = false);
+
+        /**
+         * @brief      Joins all the background workers
+         */
+        void stop();
+
+        /**
+         * @brief      Gets the number of threads executing tasks
+         *
+         * @return     Number of slots in the pool
+         */
+        unsigned size() const { return slots.size(); }
+
+        /**
+         * @brief      Whether the threads are pinned to CPUs
+         */
+        bool pinned() const { return pinThreads; }
+
+        /**
+         * @brief      Gets the slot of the calling thread
+         *
+         * @return     Index in [0, size()). Threads that do not belong to the
+         *             pool share slot 0
+         */
+        static unsigned currentSlot();
+
+        /**
+         * @brief      Gets a copy of every slot's counters
+         *
+         * @details    May be called while tasks are running, the counters
+         *             are then a snapshot. The idle time of workers that are
+         *             asleep includes the current wait
+         */
+        std::vector<WorkerStats> stats() const;
+
+        /**
+         * @brief      Sets all counters back to 0
+         *
+         * @details    Workers asleep at that point only count their idle
+         *             time from now on
+         */
+        void resetStats();
+
+        ~ThreadPool();
+
+private:
+        struct Task {
+                std::function<void()> fn;
+                TaskGroup *           group;
+                PerfCounters::Phase   phase;  // of the thread that queued it
+        };
+
+        /**
+         * @brief      The counters of WorkerStats. Relaxed atomics: they are
+         *             written by the slot's thread (and by threads outside
+         *             the pool, which share slot 0) while stats() and
+         *             resetStats() may run on another
+         */
+        struct Counters {
+                std::atomic<unsigned long long> executed, steals, idle;
+                std::atomic<long long>          idleNanoseconds;
+                Counters()
+                    : executed(0), steals(0), idle(0), idleNanoseconds(0) {}
+        };
+
+        /**
+         * @brief      Per thread state. Padded so that the counters of two
+         *             slots do not share a cache line
+         */
+        struct Slot {
+                std::mutex             lock;
+                std::deque<Task>       tasks;
+                Counters               counters;
+                std::atomic<long long> idleSince;  // ns asleep, 0 if awake
+                char                   padding[64];
+                Slot() : idleSince(0) {}
+        };
+
+        ThreadPool();
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /**
+         * @brief      Queues a task on the calling thread's deque
+         */
+        void push(Task task);
+
+        /**
+         * @brief      Takes a task from the calling thread's deque or, failing
+         *             that, steals one from another slot
+         *
+         * @param[in]  self  The calling thread's slot
+         * @param      out   The task (output parameter)
+         *
+         * @return     Whether a task was found
+         */
+        bool pop(unsigned self, Task &out);
+
+        /**
+         * @brief      Runs a task and signals its group
+         */
+        void execute(unsigned self, Task &task);
+
+        /**
+         * @brief      Main loop of background worker threads
+         */
+        void workerLoop(unsigned self);
+
+        /**
+         * @brief      Nanoseconds of an idle period that started at since (in
+         *             steady_clock nanoseconds), counted from statsEpoch
+         */
+        long long idleNanosecondsSince(long long since) const;
+
+        std::vector<Slot *>      slots;
+        std::vector<std::thread> workers;
+        std::atomic<long>        queued;    // tasks sitting in any deque
+        std::atomic<int>         sleeping;  // workers blocked on wakeup
+        std::atomic<bool>        stopping;
+        std::atomic<long long>   statsEpoch;  // last resetStats, in ns
+        bool                     pinThreads;
+        std::mutex               sleepLock;
+        std::condition_variable  wakeup;
+
+        friend class TaskGroup;
+};
+
+/**
+ * @brief      Set of tasks that can be waited on together
+ *
+ * @details    The destructor waits, so a group going out of scope never
+ *             leaves tasks that reference dead stack frames. A task that
+ *             throws still completes: the first exception of the group is
+ *             kept and rethrown by wait() once every task has completed
+ */
+class TaskGroup {
+public:
+        TaskGroup() : pending(0) {}
+        ~TaskGroup() { waitAll(); }
+
+        /**
+         * @brief      Queues fn to be run by any thread of the pool
+         *
+         * @param[in]  fn    The task
+         */
+        void run(std::function<void()> fn);
+
+        /**
+         * @brief      Runs queued tasks until every task of the group has
+         *             completed
+         *
+         * @details    Rethrows the first exception thrown by a task of the
+         *             group, if any
+         */
+        void wait();
+
+private:
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        /**
+         * @brief      Runs queued tasks until every task of the group has
+         *             completed, without rethrowing
+         */
+        void waitAll();
+
+        /**
+         * @brief      Keeps the exception of a task, unless one was kept
+         *             already
+         */
+        void fail(std::exception_ptr e);
+
+        std::atomic<long>  pending;
+        std::mutex         errorLock;
+        std::exception_ptr error;  // first exception thrown by a task
+
+        friend class ThreadPool;
+};
+
+/**
+ * @brief      Calls body on consecutive sub ranges of [begin, end) in
+ *             parallel, and returns once every sub range has been processed
+ *
+ * @param[in]  begin  First index
+ * @param[in]  end    One past the last index
+ * @param[in]  grain  Maximum number of indices per task
+ * @param[in]  body   Called as body(first, last) for each sub range
+ */
+void parallelFor(size_t begin, size_t end, size_t grain,
+                 const std::function<void(size_t, size_t)> &body);
+
+/**
+ * @brief      Sorts v in parallel
+ *
+ * @details    Sorts one run per chunk of v in parallel, then merges pairs of
+ *             adjacent runs in parallel rounds. Like std::sort, the order of
+ *             elements that compare equal is unspecified
+ *
+ * @param      v     The vector to sort
+ * @param[in]  comp  Strict weak ordering
+ */
+template <class T, class Compare>
+void parallelSort(std::vector<T> &v, Compare comp) {
+        constexpr size_t grain = 1 << 16;  // smallest run worth a task
+        size_t           n     = v.size();
+        size_t           numRuns =
+            std::min<size_t>(n / grain, 4 * ThreadPool::instance().size());
+
+        if (numRuns < 2) {
+                std::sort(v.begin(), v.end(), comp);
+                return;
+        }
+
+        std::vector<size_t> bounds;
+        for (size_t i = 0; i <= numRuns; i++)
+                bounds.push_back(i * n / numRuns);
+
+        parallelFor(0, numRuns, 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++)
+                        std::sort(v.begin() + bounds[i],
+                                  v.begin() + bounds[i + 1], comp);
+        });
+
+        std::vector<T>  buffer(v);
+        std::vector<T> *src = &v, *dst = &buffer;
+        while (bounds.size() > 2) {
+                size_t              pairs = (bounds.size() - 1) / 2;
+                std::vector<size_t> merged;
+
+                parallelFor(0, pairs + 1, 1, [&](size_t first, size_t last) {
+                        size_t end = bounds.size() - 1;
+                        for (size_t i = first; i < last; i++) {
+                                // a run without a partner is merged with
+                                // an empty range, i.e. copied
+                                size_t b0 = bounds[std::min(2 * i, end)];
+                                size_t b1 = bounds[std::min(2 * i + 1, end)];
+                                size_t b2 = bounds[std::min(2 * i + 2, end)];
+                                std::merge(src->begin() + b0,
+                                           src->begin() + b1,
+                                           src->begin() + b1,
+                                           src->begin() + b2,
+                                           dst->begin() + b0, comp);
+                        }
+                });
+
+                for (size_t i = 0; i < bounds.size(); i += 2)
+                        merged.push_back(bounds[i]);
+                if (merged.back() != n)
+                        merged.push_back(n);
+                bounds.swap(merged);
+                std::swap(src, dst);
+        }
+
+        if (src != &v)
+                v.swap(buffer);
+}
+
+}  // namespace RayTracerxx
+
+#endif
@@ -0,0 +1,116 @@
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Log.h"
+#include "ThreadPool.h"
+
+namespace RayTracerxx {
+
+// Buffer of the calling thread, NULL until the thread first records
+static thread_local void *thisBuffer = NULL;
+
+Tracer &Tracer::instance() {
+        static Tracer tracer;
+        return tracer;
+}
+
+Tracer::Tracer() : buffers(NULL), numBuffers(0), recording(false) {}
+
+Tracer::~Tracer() {
+        if (enabled())
+                stop();
+
+        Buffer *b = buffers.load();
+        while (b != NULL) {
+                Buffer *next = b->next;
+                delete b;
+                b = next;
+        }
+}
+
+void Tracer::start(const std::string &file) {
+        recording = false;
+        for (Buffer *b = buffers.load(); b != NULL; b = b->next)
+                b->events.clear();
+
+        filename  = file;
+        origin    = std::chrono::steady_clock::now();
+        recording = true;
+}
+
+void Tracer::stop() {
+        if (not enabled())
+                return;
+        recording = false;
+
+        std::ofstream out(filename.c_str());
+        if (not out.is_open()) {
+                std::cerr << "Unable to open trace file: " << filename << "\n";
+                return;
+        }
+        write(out);
+        Log::out() << "Trace written to " << filename << "\n";
+}
+
+long long Tracer::now() const {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now() - origin)
+            .count();
+}
+
+void Tracer::record(const Event &event) {
+        threadBuffer()->events.push_back(event);
+}
+
+/**
+ * @brief      New buffers are pushed on the list with a compare and swap, so
+ *             even registering does not lock
+ */
+Tracer::Buffer *Tracer::threadBuffer() {
+        if (thisBuffer != NULL)
+                return static_cast<Buffer *>(thisBuffer);
+
+        Buffer *b = new Buffer();
+        b->lane   = numBuffers++;
+        b->slot   = ThreadPool::currentSlot();
+        b->next   = buffers.load();
+        while (not buffers.compare_exchange_weak(b->next, b))
+                ;
+        thisBuffer = b;
+        return b;
+}
+
+void Tracer::write(std::ostream &out) const {
+        bool first = true;
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+        for (const Buffer *b = buffers.load(); b != NULL; b = b->next) {
+                // names the lane after the thread's ThreadPool slot
+                out << (first ? "" : ",\n")
+                    << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                       "\"tid\": "
+                    << b->lane << ", \"args\": {\"name\": \""
+                    << (b->slot == 0 ? "main" : "worker ")
+                    << (b->slot == 0 ? "" : std::to_string(b->slot))
+                    << "\"}}";
+                first = false;
+
+                for (const Event &e : b->events) {
+                        out << ",\n{\"name\": \"" << e.name
+                            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                            << b->lane << ", \"ts\": " << e.start
+                            << ", \"dur\": " << e.duration;
+                        if (e.argName != NULL)
+                                out << ", \"args\": {\"" << e.argName
+                                    << "\": " << e.arg << "}";
+                        out << "}";
+                }
+        }
+        out << "\n]}\n";
+}
+
+}  // namespace RayTracerxx
@@ -0,0 +1,154 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Records timed scopes of every thread, and writes them as a
+ *             Chrome trace (chrome://tracing, Perfetto) with one lane per
+ *             thread
+ *
+ * @details    Each thread appends to its own buffer, so recording takes no
+ *             lock. A thread's buffer is registered (lock free) the first
+ *             time it records. The trace is written by stop(), or at exit if
+ *             the tracer is still running.
+ *
+ *             Use TraceScope to record; scopes cost one flag check while
+ *             the tracer is stopped.
+ */
+class Tracer {
+public:
+        /**
+         * @brief      A completed scope
+         */
+        struct Event {
+                const char *name;     // string literal
+                const char *argName;  // string literal, or NULL
+                long long   arg;
+                long long   start;  // microseconds since start()
+                long long   duration;
+        };
+
+        /**
+         * @brief      Gets the process wide tracer
+         *
+         * @return     The tracer
+         */
+        static Tracer &instance();
+
+        /**
+         * @brief      Starts recording, dropping anything recorded before
+         *
+         * @param[in]  filename  Where the trace is written
+         */
+        void start(const std::string &filename);
+
+        /**
+         * @brief      Stops recording and writes the trace
+         *
+         * @details    Must not be called while other threads are recording
+         */
+        void stop();
+
+        /**
+         * @brief      Checks whether scopes are being recorded
+         */
+        bool enabled() const {
+                return recording.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief      Gets the time since start()
+         *
+         * @return     Microseconds
+         */
+        long long now() const;
+
+        /**
+         * @brief      Adds an event to the calling thread's buffer
+         *
+         * @param[in]  event  The event
+         */
+        void record(const Event &event);
+
+        ~Tracer();
+
+private:
+        /**
+         * @brief      Events of one thread. Buffers are never freed, so the
+         *             thread local pointer to them stays valid
+         */
+        struct Buffer {
+                std::vector<Event> events;
+                unsigned           lane;  // trace thread id
+                unsigned           slot;  // ThreadPool slot when registered
+                Buffer *           next;
+        };
+
+        Tracer();
+        Tracer(const Tracer &) = delete;
+        Tracer &operator=(const Tracer &) = delete;
+
+        /**
+         * @brief      Gets the calling thread's buffer, registering it first
+         *             if needed
+         */
+        Buffer *threadBuffer();
+
+        /**
+         * @brief      Writes every buffer in the Chrome trace event format
+         */
+        void write(std::ostream &out) const;
+
+        std::atomic<Buffer *>                 buffers;  // list of all buffers
+        std::atomic<unsigned>                 numBuffers;
+        std::atomic<bool>                     recording;
+        std::string                           filename;
+        std::chrono::steady_clock::time_point origin;
+};
+
+/**
+ * @brief      Records the lifetime of the object as a Tracer event
+ */
+class TraceScope {
+public:
+        /**
+         * @brief      Starts a scope
+         *
+         * @param[in]  name     String literal naming the scope. NULL records
+         *                      nothing
+         * @param[in]  argName  String literal naming arg, or NULL
+         * @param[in]  arg      Value shown with the event
+         */
+        explicit TraceScope(const char *name, const char *argName = NULL,
+                            long long arg = 0) {
+                active = name != NULL and Tracer::instance().enabled();
+                if (active)
+                        event = {name, argName, arg, Tracer::instance().now(),
+                                 0};
+        }
+
+        ~TraceScope() {
+                if (active) {
+                        event.duration = Tracer::instance().now() - event.start;
+                        Tracer::instance().record(event);
+                }
+        }
+
+private:
+        TraceScope(const TraceScope &) = delete;
+        TraceScope &operator=(const TraceScope &) = delete;
+
+        bool          active;
+        Tracer::Event event;
+};
+
+}  // namespace RayTracerxx
+
+#endif
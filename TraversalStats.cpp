@@ -0,0 +1,118 @@
+#include "TraversalStats.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace RayTracerxx {
+
+TraversalStats::Slot::Slot() {
+        std::fill_n(&rays[0], NUM_KINDS, 0);
+        std::fill_n(&total[0][0], NUM_KINDS * NUM_COUNTERS, 0);
+        std::fill_n(&max[0][0], NUM_KINDS * NUM_COUNTERS, 0);
+        std::fill_n(&histogram[0][0][0],
+                    NUM_KINDS * NUM_COUNTERS * (maxValue + 1), 0);
+}
+
+TraversalStats &TraversalStats::instance() {
+        static TraversalStats stats;
+        return stats;
+}
+
+TraversalStats::~TraversalStats() {
+        for (Slot *s : slots)
+                delete s;
+}
+
+void TraversalStats::reset(unsigned numThreads) {
+        for (Slot *s : slots)
+                delete s;
+        slots.clear();
+        for (unsigned i = 0; i < numThreads; i++)
+                slots.push_back(new Slot());
+}
+
+void TraversalStats::record(RayKind kind, const RayCounters &counters) {
+        unsigned self = ThreadPool::currentSlot();
+        if (self >= slots.size())
+                return;
+
+        Slot &         s         = *slots[self];
+        const uint32_t values[NUM_COUNTERS] = {counters.inner, counters.leaves,
+                                               counters.tris, counters.hits};
+        s.rays[kind]++;
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+                s.total[kind][c] += values[c];
+                s.max[kind][c] = std::max(s.max[kind][c], values[c]);
+                s.histogram[kind][c][std::min(values[c], maxValue)]++;
+        }
+}
+
+unsigned long long TraversalStats::numRays(RayKind kind) const {
+        unsigned long long rays = 0;
+        for (const Slot *s : slots)
+                rays += s->rays[kind];
+        return rays;
+}
+
+/**
+ * @brief      Percentiles are the smallest value whose bucket reaches the
+ *             requested fraction of the rays
+ */
+void TraversalStats::print(std::ostream &out) const {
+        const char *kinds[NUM_KINDS]       = {"Primary", "Shadow"};
+        const char *names[NUM_COUNTERS]    = {"inner nodes", "leaves",
+                                           "tri tests", "hits"};
+        const double percentiles[]         = {0.5, 0.9, 0.99};
+        std::ios::fmtflags flags           = out.flags();
+        std::streamsize    precision       = out.precision();
+
+        for (int k = 0; k < NUM_KINDS; k++) {
+                unsigned long long rays = numRays(RayKind(k));
+                out << kinds[k] << " rays: " << rays << "\n";
+                if (rays == 0)
+                        continue;
+
+                out << "  " << std::left << std::setw(12) << "counter"
+                    << std::right << std::setw(14) << "total"
+                    << std::setw(10) << "mean" << std::setw(7) << "p50"
+                    << std::setw(7) << "p90" << std::setw(7) << "p99"
+                    << std::setw(8) << "max"
+                    << "\n";
+
+                for (int c = 0; c < NUM_COUNTERS; c++) {
+                        unsigned long long total = 0;
+                        uint32_t           max   = 0;
+                        std::vector<unsigned long long> histogram(maxValue + 1,
+                                                                  0);
+                        for (const Slot *s : slots) {
+                                total += s->total[k][c];
+                                max = std::max(max, s->max[k][c]);
+                                for (uint32_t v = 0; v <= maxValue; v++)
+                                        histogram[v] += s->histogram[k][c][v];
+                        }
+
+                        out << "  " << std::left << std::setw(12) << names[c]
+                            << std::right << std::setw(14) << total
+                            << std::setw(10) << std::fixed
+                            << std::setprecision(2) << double(total) / rays;
+
+                        for (double p : percentiles) {
+                                unsigned long long seen = 0;
+                                uint32_t           v    = 0;
+                                for (; v < maxValue; v++) {
+                                        seen += histogram[v];
+                                        if (seen >= p * rays)
+                                                break;
+                                }
+                                out << std::setw(7) << v;
+                        }
+                        out << std::setw(8) << max << "\n";
+                }
+        }
+        out.flags(flags);
+        out.precision(precision);
+}
+
+}  // namespace RayTracerxx
@@ -0,0 +1,128 @@
+#ifndef TRAVERSALSTATS_H
+#define TRAVERSALSTATS_H
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+/*
+ * Traversal counters are only compiled in when RAYTRACER_STATS is defined
+ * (make STATS=1). Otherwise Ray carries no counters and STAT_COUNT expands
+ * to nothing, so the traversal code is the same as without instrumentation
+ */
+#ifdef RAYTRACER_STATS
+#define STAT_COUNT(ray, counter) ((ray).counters.counter++)
+#else
+#define STAT_COUNT(ray, counter) ((void)0)
+#endif
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Work done by the KDTree for a single ray
+ */
+struct RayCounters {
+        uint32_t inner;   // inner nodes visited
+        uint32_t leaves;  // leaves visited
+        uint32_t tris;    // triangle intersection tests
+        uint32_t hits;    // tests that found a closer hit
+
+        RayCounters() : inner(0), leaves(0), tris(0), hits(0) {}
+
+        // nodes visited plus triangles tested
+        uint32_t cost() const { return inner + leaves + tris; }
+
+        RayCounters &operator+=(const RayCounters &c) {
+                inner += c.inner;
+                leaves += c.leaves;
+                tris += c.tris;
+                hits += c.hits;
+                return *this;
+        }
+};
+
+/**
+ * @brief      Distribution of the RayCounters of every ray traced during a
+ *             render, for primary and shadow rays separately
+ *
+ * @details    Every thread of the ThreadPool records into its own slot, so
+ *             recording takes no lock. Slots keep a histogram per counter
+ *             (exact up to maxValue), from which the report derives means
+ *             and percentiles once the render is done
+ */
+class TraversalStats {
+public:
+        enum RayKind { PRIMARY = 0, SHADOW, NUM_KINDS };
+        enum Counter { INNER = 0, LEAVES, TRIS, HITS, NUM_COUNTERS };
+
+        // Larger values share the last histogram bucket
+        static constexpr uint32_t maxValue = 4095;
+
+        /**
+         * @brief      Gets the process wide statistics
+         *
+         * @return     The statistics
+         */
+        static TraversalStats &instance();
+
+        /**
+         * @brief      Clears the statistics, with one slot per thread
+         *
+         * @details    Must not be called while rays are being recorded
+         *
+         * @param[in]  numThreads  Size of the ThreadPool
+         */
+        void reset(unsigned numThreads);
+
+        /**
+         * @brief      Adds the counters of a ray to the calling thread's
+         *             slot
+         *
+         * @param[in]  kind      Primary or shadow ray
+         * @param[in]  counters  The counters of the ray
+         */
+        void record(RayKind kind, const RayCounters &counters);
+
+        /**
+         * @brief      Gets the number of rays recorded
+         *
+         * @param[in]  kind  Primary or shadow rays
+         *
+         * @return     Number of rays
+         */
+        unsigned long long numRays(RayKind kind) const;
+
+        /**
+         * @brief      Prints totals, means and percentiles of every counter
+         *
+         * @param      out   The stream
+         */
+        void print(std::ostream &out) const;
+
+        ~TraversalStats();
+
+private:
+        /**
+         * @brief      Counters of one thread. Padded so that two slots do
+         *             not share a cache line
+         */
+        struct Slot {
+                unsigned long long rays[NUM_KINDS];
+                unsigned long long total[NUM_KINDS][NUM_COUNTERS];
+                uint32_t           max[NUM_KINDS][NUM_COUNTERS];
+                unsigned long long histogram[NUM_KINDS][NUM_COUNTERS]
+                                            [maxValue + 1];
+                char               padding[64];
+                Slot();
+        };
+
+        TraversalStats() {}
+        TraversalStats(const TraversalStats &) = delete;
+        TraversalStats &operator=(const TraversalStats &) = delete;
+
+        std::vector<Slot *> slots;
+};
+
+}  // namespace RayTracerxx
+
+#endif
@@ -13,9 +13,16 @@
 #include <vector>
 #include "Box.h"
 #include "ImageEngine.h"
+#include "Log.h"
 #include "OrderedList.h"
+#include "PerfCounters.h"
+#include "RayCapture.h"
 #include "PolyObject.h"
 #include "Scene.h"
+#include "StatsReport.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "TraversalStats.h"
 #include "rgb.h"
 #include <unistd.h>
 
@@ -29,6 +36,15 @@ void translate(std::istream&, RayTracerxx::Scene*&);
 void help(std::istream&, RayTracerxx::Scene*&);
 void preview(std::istream&, RayTracerxx::Scene*&);
 void setPosition(std::istream&, RayTracerxx::Scene*&);
+void threads(std::istream&, RayTracerxx::Scene*&);
+void buildMode(std::istream&, RayTracerxx::Scene*&);
+void perfectSplits(std::istream&, RayTracerxx::Scene*&);
+void stats(std::istream&, RayTracerxx::Scene*&);
+void heatmap(std::istream&, RayTracerxx::Scene*&);
+void treeStats(std::istream&, RayTracerxx::Scene*&);
+void trace(std::istream&, RayTracerxx::Scene*&);
+void perfCounters(std::istream&, RayTracerxx::Scene*&);
+void captureRays(std::istream&, RayTracerxx::Scene*&);
 
 void        run(std::istream&, RayTracerxx::Scene*&);
 bool        assertScene(RayTracerxx::Scene*& scene);
@@ -40,18 +56,51 @@ void        Error(std::string message);
 
 const std::string COMMANDS[] = {"newScene", "newLight",   "newObject", "load",
                                 "debug",    "render",     "translate", "help",
-                                "preview",  "setPosition"};
+                                "preview",  "setPosition", "threads",
+                                "buildMode", "perfectSplits", "stats",
+                                "heatmap",   "treeStats", "trace",
+                                "perfCounters", "captureRays"};
 
 const int NUM_COMMANDS = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
 
 void (*const FUNCTIONS[])(std::istream&, RayTracerxx::Scene*&) = {
     newScene, newLight,  newObject, load,    debug,
-    render,   translate, help,      preview, setPosition};
+    render,   translate, help,      preview, setPosition,
+    threads,  buildMode, perfectSplits, stats,   heatmap,
+    treeStats, trace,     perfCounters, captureRays};
+
+/**
+ * @brief      Reads commands from stdin
+ *
+ * @details    Options: --stats-json file writes a JSON report of every load
+ *             and render (see StatsReport.h), -q keeps stderr for errors
+ *             and -v adds the details of loading and building
+ */
+int main(int argc, char* argv[]) {
+        using RayTracerxx::Log;
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--stats-json" and i + 1 < argc)
+                        RayTracerxx::StatsReport::instance().start(argv[++i]);
+                else if (arg == "-q" or arg == "--quiet")
+                        Log::setVerbosity(Log::QUIET);
+                else if (arg == "-v" or arg == "--verbose")
+                        Log::setVerbosity(Log::DETAIL);
+                else {
+                        std::cerr << "Usage: RayTracer++ [--stats-json file] "
+                                     "[-q | -v] < commands\n";
+                        return 2;
+                }
+        }
 
-int main() {
         RayTracerxx::Scene* scene = NULL;
+        RayTracerxx::ThreadPool::instance().start();
         run(std::cin, scene);
 
+        // writes the trace if it is still being recorded
+        RayTracerxx::Tracer::instance().stop();
+        RayTracerxx::StatsReport::instance().write();
+
         if (scene != NULL)
                 delete scene;
 
@@ -140,8 +189,15 @@ void newObject(std::istream& stream, RayTracerxx::Scene*& scene) {
         std::string filename;
         stream >> filename;
 
-        if (scene != NULL)
-                scene->addObject(RayTracerxx::PolyObject(filename));
+        auto                    start = std::chrono::steady_clock::now();
+        RayTracerxx::PolyObject object(filename);
+        std::chrono::duration<double> load =
+            std::chrono::steady_clock::now() - start;
+
+        RayTracerxx::StatsReport& report = RayTracerxx::StatsReport::instance();
+        if (report.enabled())
+                report.addObject({filename, object.mesh.size(), load.count()});
+        scene->addObject(std::move(object));
 }
 
 void load(std::istream& stream, RayTracerxx::Scene*& scene) {
@@ -165,6 +221,15 @@ void debug(std::istream& stream, RayTracerxx::Scene*& scene) {
         (void)stream;
         std::cout << "Num Objects: " << scene->numObjects() << "\n";
         std::cout << "Num Lights: " << scene->numLights() << "\n";
+
+        RayTracerxx::ThreadPool& pool = RayTracerxx::ThreadPool::instance();
+        std::vector<RayTracerxx::ThreadPool::WorkerStats> stats = pool.stats();
+        std::cout << "Num Threads: " << pool.size() << "\n";
+        for (size_t i = 0; i < stats.size(); i++)
+                std::cout << "  Thread " << i << ": " << stats[i].executed
+                          << " tasks, " << stats[i].steals << " steals, "
+                          << stats[i].idle << " idle ("
+                          << stats[i].idleSeconds << " s)\n";
 }
 
 void render(std::istream& stream, RayTracerxx::Scene*& scene) {
@@ -176,8 +241,43 @@ void render(std::istream& stream, RayTracerxx::Scene*& scene) {
 
         output.newImage(scene->getWidth(), scene->getHeight());
         scene->renderScene();
+        auto start = std::chrono::steady_clock::now();
         output.copyScreen(scene->camera.screen);
         output.save(filename);
+        std::chrono::duration<double> encode =
+            std::chrono::steady_clock::now() - start;
+
+        RayTracerxx::StatsReport& report = RayTracerxx::StatsReport::instance();
+        if (report.enabled()) {
+                RayTracerxx::RenderStats stats = scene->getRenderStats();
+                stats.output                   = filename;
+                stats.encodeSeconds            = encode.count();
+                report.addRender(stats);
+                report.write();
+        }
+
+        const std::vector<uint32_t>& cost = scene->getTraversalCost();
+        if (scene->heatmapEnabled() and not cost.empty()) {
+                // scale to the 99th percentile, so a few outliers do not
+                // leave the rest of the image dark
+                std::vector<uint32_t> sorted(cost);
+                auto p99 = sorted.begin() + sorted.size() * 99 / 100;
+                std::nth_element(sorted.begin(), p99, sorted.end());
+
+                size_t      dot  = filename.find_last_of('.');
+                std::string name = (dot == std::string::npos)
+                                       ? filename + "-heatmap"
+                                       : filename.substr(0, dot) + "-heatmap" +
+                                             filename.substr(dot);
+
+                RayTracerxx::ImageEngine heat;
+                heat.newImage(scene->getWidth(), scene->getHeight());
+                heat.copyHeatmap(cost, *p99);
+                heat.save(name);
+                RayTracerxx::Log::out()
+                    << "Heatmap: " << name << " (red = " << *p99
+                    << " or more nodes + triangle tests per pixel)\n";
+        }
 }
 
 void preview(std::istream& stream, RayTracerxx::Scene*& scene) {
@@ -268,6 +368,163 @@ void setPosition(std::istream& stream, RayTracerxx::Scene*& scene) {
         scene->camera.setPosition(position[0], position[1], position[2]);
 }
 
+void threads(std::istream& stream, RayTracerxx::Scene*& scene) {
+        (void)scene;
+        std::string input;
+        int         n = 0;
+        stream >> input;
+        try {
+                n = stoi(input);
+                if (n < 0)
+                        throw std::logic_error("");
+        } catch (const std::logic_error& e) {
+                Error("Number of threads must be a non negative integer");
+                usageError("threads");
+                return;
+        }
+        RayTracerxx::ThreadPool::instance().start(n);
+}
+
+void buildMode(std::istream& stream, RayTracerxx::Scene*& scene) {
+        if (not assertScene(scene))
+                return;
+
+        RayTracerxx::KDTree::BuildOptions opts = scene->getBuildOptions();
+        std::string                       input;
+        stream >> input;
+        opts.bins = 0;
+        if (input == "binned") {
+                stream >> input;
+                try {
+                        int bins = stoi(input);
+                        if (bins < 2)
+                                throw std::logic_error("");
+                        opts.bins = bins;
+                } catch (const std::logic_error& e) {
+                        Error("Number of bins must be an integer above 1");
+                        usageError("buildMode");
+                        return;
+                }
+        } else if (input != "sah") {
+                Error("Unknown build mode " + truncate(input));
+                usageError("buildMode");
+                return;
+        }
+        scene->setBuildOptions(opts);
+}
+
+void perfectSplits(std::istream& stream, RayTracerxx::Scene*& scene) {
+        if (not assertScene(scene))
+                return;
+
+        RayTracerxx::KDTree::BuildOptions opts = scene->getBuildOptions();
+        std::string                       input;
+        stream >> input;
+        if (input != "on" and input != "off") {
+                Error("perfectSplits must be on or off");
+                usageError("perfectSplits");
+                return;
+        }
+        opts.perfectSplits = (input == "on");
+        scene->setBuildOptions(opts);
+}
+
+void stats(std::istream& stream, RayTracerxx::Scene*& scene) {
+        (void)stream;
+        (void)scene;
+#ifdef RAYTRACER_STATS
+        RayTracerxx::TraversalStats::instance().print(std::cout);
+#else
+        Error("Traversal statistics are not compiled in (make STATS=1)");
+#endif
+}
+
+void heatmap(std::istream& stream, RayTracerxx::Scene*& scene) {
+        if (not assertScene(scene))
+                return;
+
+        std::string input;
+        stream >> input;
+        if (input != "on" and input != "off") {
+                Error("heatmap must be on or off");
+                usageError("heatmap");
+                return;
+        }
+#ifdef RAYTRACER_STATS
+        scene->setHeatmap(input == "on");
+#else
+        if (input == "on")
+                Error("Heatmaps need the traversal counters (make STATS=1)");
+#endif
+}
+
+void treeStats(std::istream& stream, RayTracerxx::Scene*& scene) {
+        if (not assertScene(scene))
+                return;
+
+        std::string input;
+        stream >> input;
+        if (input != "text" and input != "json") {
+                Error("Report format must be text or json");
+                usageError("treeStats");
+                return;
+        }
+
+        const RayTracerxx::KDTree* tree = scene->getTree();
+        if (tree == NULL) {
+                Error("Scene has no objects");
+                return;
+        }
+
+        RayTracerxx::KDTree::Report report = tree->report();
+        if (input == "json")
+                report.printJSON(std::cout);
+        else
+                report.print(std::cout);
+}
+
+void trace(std::istream& stream, RayTracerxx::Scene*& scene) {
+        (void)scene;
+        std::string input;
+        stream >> input;
+        if (input.empty()) {
+                usageError("trace");
+                return;
+        }
+
+        if (input == "off")
+                RayTracerxx::Tracer::instance().stop();
+        else
+                RayTracerxx::Tracer::instance().start(input);
+}
+
+void perfCounters(std::istream& stream, RayTracerxx::Scene*& scene) {
+        (void)scene;
+        std::string input;
+        stream >> input;
+        if (input != "on" and input != "off") {
+                Error("perfCounters must be on or off");
+                usageError("perfCounters");
+                return;
+        }
+        RayTracerxx::PerfCounters::instance().enable(input == "on");
+}
+
+void captureRays(std::istream& stream, RayTracerxx::Scene*& scene) {
+        (void)scene;
+        std::string input;
+        stream >> input;
+        if (input.empty()) {
+                usageError("captureRays");
+                return;
+        }
+
+        if (input == "off")
+                RayTracerxx::RayCapture::instance().stop();
+        else
+                RayTracerxx::RayCapture::instance().start(input);
+}
+
 std::string truncate(std::string& input) {
         int maxSize = 15;
         int len     = input.size();
@@ -298,6 +555,46 @@ void usageError(std::string command) {
                 case 7: std::cerr << "Usage: help [command]\n"; break;
                 case 8: std::cerr << "Usage: preview\n"; break;
                 case 9: std::cerr << "Usage: setPosition  f f f\n"; break;
+                case 10:
+                        std::cerr << "Usage: threads int  (0 = all cores)\n";
+                        break;
+                case 11:
+                        std::cerr << "Usage: buildMode sah\n";
+                        std::cerr << "       buildMode binned int  (bins per "
+                                     "axis, e.g. 32 or 64)\n";
+                        break;
+                case 12:
+                        std::cerr << "Usage: perfectSplits on | off\n";
+                        break;
+                case 13:
+                        std::cerr << "Usage: stats  (counters of the last "
+                                     "render, needs make STATS=1)\n";
+                        break;
+                case 14:
+                        std::cerr << "Usage: heatmap on | off  (render also "
+                                     "writes [name]-heatmap.ppm, needs make "
+                                     "STATS=1)\n";
+                        break;
+                case 15:
+                        std::cerr << "Usage: treeStats text | json\n";
+                        break;
+                case 16:
+                        std::cerr << "Usage: trace [path to json file]  "
+                                     "(written at exit or by trace off)\n";
+                        std::cerr << "       trace off\n";
+                        break;
+                case 17:
+                        std::cerr << "Usage: perfCounters on | off  (build "
+                                     "and render report cycles, "
+                                     "instructions, cache, branch and TLB "
+                                     "misses per phase)\n";
+                        break;
+                case 18:
+                        std::cerr << "Usage: captureRays [path to ray file]  "
+                                     "(render writes every ray it traces, "
+                                     "see replayRays)\n";
+                        std::cerr << "       captureRays off\n";
+                        break;
                 default: break;
         }
 }
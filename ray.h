@@ -6,6 +6,7 @@
 #include <iostream>
 #include <limits>
 #include "OrderedList.h"
+#include "TraversalStats.h"
 
 namespace RayTracerxx {
 struct Triangle;
@@ -19,9 +20,12 @@ public:
         Point<3>  origin;
         Vector<3> direction;
         Number_t  t;
-        Triangle *hit;
+        const Triangle *hit;
         bool      isNeg[3];
         Number_t  intersectionBias = 1e-6;
+#ifdef RAYTRACER_STATS
+        RayCounters counters;  // work done by KDTree for this ray
+#endif
 
         Ray(const Number_t point[3], const Number_t direc[3])
             : origin(point), direction(direc) {
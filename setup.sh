@@ -5,20 +5,14 @@
 
 echo "Downloading example ply files"
 echo ""
-if ! [ -f assets/sphere.ply ]; then
-        wget https://people.sc.fsu.edu/~jburkardt/data/ply/sphere.ply -P assets
-fi
-
-if ! [ -f assets/street_lamp.ply ]; then
-        wget https://people.sc.fsu.edu/~jburkardt/data/ply/street_lamp.ply -P assets
-fi
-
-if ! [ -f assets/cow.ply ]; then
-        wget https://people.sc.fsu.edu/~jburkardt/data/ply/cow.ply -P assets
-fi
-
-if ! [ -f assets/beethoven.ply ]; then
-        wget https://people.sc.fsu.edu/~jburkardt/data/ply/beethoven.ply -P assets
+if command -v wget > /dev/null; then
+        for PLY in sphere street_lamp cow beethoven; do
+                if ! [ -f assets/$PLY.ply ]; then
+                        wget https://people.sc.fsu.edu/~jburkardt/data/ply/$PLY.ply -P assets
+                fi
+        done
+else
+        echo "wget not found, only rendering generated meshes"
 fi
 
 
@@ -36,6 +30,11 @@ if ! make unittests; then
         exit 1
 fi
 
+if ! make generateScene; then
+        echo "Building the scene generator failed"
+        exit 1
+fi
+
 
 echo ""
 echo "Running unittests"
@@ -52,11 +51,12 @@ if ! [ -d $OUTPUT ]; then
         mkdir $OUTPUT
 fi
 
-echo ""
-echo "Rendering sphere.ply"
-echo ""
+if [ -f assets/sphere.ply ]; then
+        echo ""
+        echo "Rendering sphere.ply"
+        echo ""
 
-./RayTracer++ << ENDOFCOMMANDS
+        ./RayTracer++ << ENDOFCOMMANDS
 newScene 1920 1080
 newObject ./assets/sphere.ply
 setPosition -8 4 304
@@ -65,12 +65,14 @@ newLight 1.000000 1.000000 0.000000 2147483647 0 0
 newLight 0.000000 1.000000 0.000000 0 2147483647 0
 render $OUTPUT/sphere.ppm
 ENDOFCOMMANDS
+fi
 
-echo ""
-echo "Rendering street_lamp.ply"
-echo ""
+if [ -f assets/street_lamp.ply ]; then
+        echo ""
+        echo "Rendering street_lamp.ply"
+        echo ""
 
-./RayTracer++ << ENDOFCOMMANDS
+        ./RayTracer++ << ENDOFCOMMANDS
 newScene 1920 1080
 newObject ./assets/street_lamp.ply
 setPosition 4 2.5 11
@@ -79,13 +81,15 @@ newLight 1.000000 1.000000 0.000000 2147483647 0 0
 newLight 0.000000 1.000000 0.000000 0 2147483647 0
 render $OUTPUT/street_lamp.ppm
 ENDOFCOMMANDS
+fi
 
 
-echo ""
-echo "Rendering cow.ply"
-echo ""
+if [ -f assets/cow.ply ]; then
+        echo ""
+        echo "Rendering cow.ply"
+        echo ""
 
-./RayTracer++ << ENDOFCOMMANDS
+        ./RayTracer++ << ENDOFCOMMANDS
 newScene 1920 1080
 newObject ./assets/cow.ply
 setPosition -0.375 1.625 3.5
@@ -94,13 +98,15 @@ newLight 1.000000 1.000000 0.000000 2147483647 0 0
 newLight 0.000000 1.000000 0.000000 0 2147483647 0
 render $OUTPUT/cow.ppm
 ENDOFCOMMANDS
+fi
 
 
-echo ""
-echo "Rendering beethoven.ply"
-echo ""
+if [ -f assets/beethoven.ply ]; then
+        echo ""
+        echo "Rendering beethoven.ply"
+        echo ""
 
-./RayTracer++ << ENDOFCOMMANDS
+        ./RayTracer++ << ENDOFCOMMANDS
 newScene 1920 1080
 newObject ./assets/beethoven.ply
 setPosition -4 0 14
@@ -109,6 +115,14 @@ newLight 1.000000 1.000000 0.000000 2147483647 0 0
 newLight 0.000000 1.000000 0.000000 0 2147483647 0
 render $OUTPUT/beethoven.ppm
 ENDOFCOMMANDS
+fi
+
+echo ""
+echo "Rendering generated spheres"
+echo ""
+
+./generateScene spheres 100K $OUTPUT/spheres.ply | ./RayTracer++
+
 
 echo ""
 echo "Check output in $OUTPUT folder"
@@ -0,0 +1,28 @@
+#ifndef BENCH_LIGHTS_H
+#define BENCH_LIGHTS_H
+
+//
+// The lights of the scenes generateScene writes, shared with the benchmarks
+// that set their scene up in code (benchRender, threadScaling), so that they
+// trace the same shadow rays as the rendered scripts and golden images.
+//
+
+namespace RayTracerxx {
+
+/**
+ * @brief      A light as the newLight command takes it: color, then position
+ */
+struct BenchLight {
+        double color[3];
+        int    position[3];
+};
+
+const BenchLight benchLights[] = {
+    {{1, 0, 0}, {2147483647, 0, 0}},
+    {{1, 1, 0}, {2147483647, 0, 0}},
+    {{0, 1, 0}, {0, 2147483647, 0}},
+};
+
+}  // namespace RayTracerxx
+
+#endif
@@ -0,0 +1,105 @@
+#include "ImageEngine.h"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+using RayTracerxx::Image;
+using RayTracerxx::ImageDiff;
+using RayTracerxx::ImageEngine;
+
+static void writeFile(const std::string& filename, const std::string& data) {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out << data;
+}
+
+TEST(ImageEngine, ReadP3) {
+        const std::string filename = "ImageEngine-unittest.ppm";
+        writeFile(filename,
+                  "P3\n# a comment\n2 # another\n 2\n255\n"
+                  "1 2 3  4 5 6\n7 8 9\t10 11\r\n12\n");
+
+        ImageEngine engine;
+        ASSERT_TRUE(engine.readImage(filename));
+        std::remove(filename.c_str());
+
+        const Image& image = engine.getImage();
+        EXPECT_EQ(image.magic_number, "P3");
+        EXPECT_EQ(image.width, 2);
+        EXPECT_EQ(image.height, 2);
+        EXPECT_EQ(image.max_color, 255);
+        ASSERT_EQ(image.colors.size(), 2u);
+        EXPECT_EQ(image.colors[0][1].red, 4);
+        EXPECT_EQ(image.colors[1][1].green, 11);
+        EXPECT_EQ(image.colors[1][1].blue, 12);
+}
+
+TEST(ImageEngine, ReadP6) {
+        const std::string filename = "ImageEngine-unittest.ppm";
+        std::string       bytes    = "P6\n2 1\n255\n";
+        for (int v : {0, 10, 255, 128, 64, 32})
+                bytes += char(v);
+        writeFile(filename, bytes);
+
+        ImageEngine engine;
+        ASSERT_TRUE(engine.readImage(filename));
+        const Image& image = engine.getImage();
+        EXPECT_EQ(image.colors[0][0].green, 10);
+        EXPECT_EQ(image.colors[0][0].blue, 255);
+        EXPECT_EQ(image.colors[0][1].blue, 32);
+
+        // two bytes per channel, most significant first
+        bytes = "P6 1 1 1000 ";
+        for (int v : {3, 232, 0, 1, 1, 0})
+                bytes += char(v);
+        writeFile(filename, bytes);
+        ASSERT_TRUE(engine.readImage(filename));
+        EXPECT_EQ(engine.getImage().colors[0][0].red, 1000);
+        EXPECT_EQ(engine.getImage().colors[0][0].green, 1);
+        EXPECT_EQ(engine.getImage().colors[0][0].blue, 256);
+
+        // truncated colors leave the image as it was
+        writeFile(filename, "P6\n2 2\n255\nabc");
+        EXPECT_FALSE(engine.readImage(filename));
+        EXPECT_EQ(engine.getImage().width, 1);
+        std::remove(filename.c_str());
+
+        EXPECT_FALSE(engine.readImage("ImageEngine-unittest-missing.ppm"));
+}
+
+TEST(ImageEngine, Compare) {
+        const std::string a = "ImageEngine-unittest-a.ppm";
+        const std::string b = "ImageEngine-unittest-b.ppm";
+        writeFile(a, "P3 2 1 255  10 20 30  40 50 60\n");
+        // the same colors on another scale, but for one channel
+        writeFile(b, "P3 2 1 510  20 40 60  80 100 130\n");
+
+        ImageEngine first, second, diff;
+        ASSERT_TRUE(first.readImage(a));
+        ASSERT_TRUE(second.readImage(b));
+        std::remove(a.c_str());
+        std::remove(b.c_str());
+
+        ImageDiff result;
+        ASSERT_TRUE(first.compare(first, result));
+        EXPECT_TRUE(std::isinf(result.psnr));
+        EXPECT_EQ(result.differentPixels, 0u);
+
+        ASSERT_TRUE(first.compare(second, result, &diff));
+        EXPECT_DOUBLE_EQ(result.maxError, 5);
+        EXPECT_EQ(result.maxX, 1);
+        EXPECT_EQ(result.differentPixels, 1u);
+        EXPECT_NEAR(result.psnr, 10 * std::log10(255.0 * 255 * 6 / 25), 1e-9);
+
+        const Image& heat = diff.getImage();
+        ASSERT_EQ(heat.colors.size(), 1u);
+        EXPECT_EQ(heat.colors[0][0].red + heat.colors[0][0].green +
+                      heat.colors[0][0].blue,
+                  0);
+        EXPECT_GT(heat.colors[0][1].blue + heat.colors[0][1].green, 0);
+
+        ImageEngine other;
+        other.newImage(3, 1);
+        EXPECT_FALSE(first.compare(other, result));
+}
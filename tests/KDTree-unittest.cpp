@@ -1,9 +1,245 @@
-#include <iostream>
 #include <gtest/gtest.h>
-// #include "PolyObject.h"
-// #include "KDTree.h"
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include "KDTree2.h"
+#include "KDTreeOracle.h"
+#include "PolyObject.h"
+
+using namespace RayTracerxx;
+
+/**
+ * @brief      Builds a tree of mesh with opts and checks random and camera
+ *             rays against brute force
+ */
+static void expectMatchesBruteForce(OracleMesh                  mesh,
+                                    const KDTree::BuildOptions& opts) {
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree                 tree(mesh.bbox, tris, opts);
+
+        std::vector<Ray> random = oracleRandomRays(mesh.bbox, 4000, 7);
+        std::vector<Ray> camera = oracleCameraRays(mesh.bbox, 64, 36);
+        for (const std::vector<Ray>* rays : {&random, &camera}) {
+                std::ostringstream log;
+                OracleResult       r = oracleCheck(tree, tris, *rays, 1e-9, log);
+                EXPECT_EQ(r.mismatches, 0u) << log.str();
+                EXPECT_GT(r.hits, 0u) << "the rays should hit the mesh";
+        }
+}
+
+TEST(KDTree, Intersect) {
+        KDTree::BuildOptions sah;
+        expectMatchesBruteForce(oracleSpheres(2000, 1), sah);
+        expectMatchesBruteForce(oracleSoup(2000, 2), sah);
+        expectMatchesBruteForce(oracleGrid(2000), sah);
+}
+
+TEST(KDTree, IntersectBinned) {
+        KDTree::BuildOptions binned;
+        binned.bins = 16;
+        expectMatchesBruteForce(oracleSpheres(2000, 3), binned);
+        expectMatchesBruteForce(oracleSoup(2000, 4), binned);
+        expectMatchesBruteForce(oracleGrid(2000), binned);
+}
+
+TEST(KDTree, IntersectPerfectSplits) {
+        KDTree::BuildOptions perfect;
+        perfect.perfectSplits = true;
+        expectMatchesBruteForce(oracleSpheres(2000, 5), perfect);
+        expectMatchesBruteForce(oracleSoup(2000, 6), perfect);
+        expectMatchesBruteForce(oracleGrid(2000), perfect);
+}
+
+TEST(KDTree, ParallelBuildMatchesBruteForce) {
+        // large enough for the builder to spawn tasks
+        ThreadPool::instance().start(4);
+        expectMatchesBruteForce(oracleSoup(12000, 8), KDTree::BuildOptions());
+        ThreadPool::instance().start(1);
+}
+
+TEST(KDTree, Occluded) {
+        // a unit square at z = 0 and a smaller one at z = 2 above its corner
+        OracleMesh mesh;
+        mesh.add({0, 0, 0}, {1, 0, 0}, {1, 1, 0});
+        mesh.add({0, 0, 0}, {1, 1, 0}, {0, 1, 0});
+        mesh.add({0, 0, 2}, {0.2, 0, 2}, {0.2, 0.2, 2});
+        mesh.add({0, 0, 2}, {0.2, 0.2, 2}, {0, 0.2, 2});
+        mesh.computeBounds();
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree                 tree(mesh.bbox, tris);
+
+        // down onto the big square from z = 5: blocked at t = 5
+        Ray down(Point<3>{0.5, 0.5, 5}, Vector<3>{0, 0, -1});
+        EXPECT_TRUE(tree.Occluded(down, 10)) << "hit before tmax";
+        EXPECT_NE(down.hit, nullptr);
+        EXPECT_FALSE(tree.Occluded(down, 4)) << "hit after tmax";
+        EXPECT_EQ(down.hit, nullptr);
+
+        // the small square is hit first, at t = 3
+        Ray corner(Point<3>{0.1, 0.1, 5}, Vector<3>{0, 0, -1});
+        EXPECT_TRUE(tree.Occluded(corner, 4));
+        EXPECT_FALSE(tree.Occluded(corner, 2.5));
+
+        // away from the squares, and past them
+        Ray up(Point<3>{0.5, 0.5, 1}, Vector<3>{0, 0, 1});
+        EXPECT_FALSE(tree.Occluded(up, 100)) << "miss";
+        Ray beside(Point<3>{3, 3, 5}, Vector<3>{0, 0, -1});
+        EXPECT_FALSE(tree.Occluded(beside, 100)) << "miss";
+}
+
+TEST(KDTree, FlatLayout) {
+        // the flat array holds a full binary tree whose leaves reference
+        // every triangle at least once
+        for (OracleMesh mesh : {oracleSpheres(2000, 9), oracleGrid(500)}) {
+                std::vector<Triangle*> tris = mesh.pointers();
+                KDTree                 tree(mesh.bbox, tris);
+                KDTree::Report         r = tree.report();
+
+                EXPECT_EQ(size_t(r.numInner + r.numLeaves), tree.numNodes());
+                EXPECT_EQ(r.numLeaves, r.numInner + 1);
+                EXPECT_GT(r.numInner, 0);
+                EXPECT_EQ(r.uniqueTris, tris.size());
+                EXPECT_GE(r.references, tris.size());
+                EXPECT_LE(r.nodeBytes, (tree.numNodes() + 16) * 16)
+                    << "nodes must stay 16 bytes";
+        }
+}
+
+TEST(KDTree, DeepTree) {
+        // triangles halving in size towards the origin ask for a split per
+        // triangle, deeper than the traversal stack
+        OracleMesh mesh;
+        for (int i = 0; i < 200; i++) {
+                double s = std::ldexp(1.0, -i);
+                mesh.add({s, 0, 0}, {2 * s, 0, s}, {s, s, 2 * s});
+        }
+        mesh.computeBounds();
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree                 tree(mesh.bbox, tris);
+        EXPECT_LE(tree.report().maxLeafDepth, 64);
+
+        // straight down onto every triangle, and random
+        std::vector<Ray> rays = oracleRandomRays(mesh.bbox, 2000, 9);
+        for (int i = 0; i < 200; i++) {
+                double s = std::ldexp(1.0, -i);
+                rays.push_back(Ray(Point<3>{s * 4 / 3, s / 3, 3},
+                                   Vector<3>{0, 0, -1}));
+        }
+        std::ostringstream log;
+        OracleResult       r = oracleCheck(tree, tris, rays, 1e-9, log);
+        EXPECT_EQ(r.mismatches, 0u) << log.str();
+        EXPECT_GE(r.hits, 100u) << "the smallest are below the epsilons";
+}
+
+TEST(KDTree, RaysStartingOnSplitPlanes) {
+        // the walls of the grid are where the builder splits: start on them
+        // and run along the axis both ways, and across the planes
+        OracleMesh             mesh = oracleGrid(2000);
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree                 tree(mesh.bbox, tris);
+        unsigned               side = unsigned(std::sqrt(2000 / 4.0));
+        double                 step = 10.0 / side;
+
+        std::vector<Ray> rays;
+        for (unsigned i = 0; i <= side; i++) {
+                for (int sign : {-1, 1}) {
+                        double w = i * step, p = 0.3 + 0.37 * i;
+                        for (int k = 0; k < 2; k++) {
+                                Point<3> origin{p, p, 1.1};
+                                origin[k] = w;
+                                Vector<3> axis{0, 0, 0}, across{0.3, 0.4, -0.5};
+                                axis[k]   = sign;
+                                across[k] = sign;
+                                across.normalize();
+                                rays.push_back(Ray(origin, axis));
+                                rays.push_back(Ray(origin, across));
+                        }
+                        // on the ground, looking along it
+                        rays.push_back(Ray(Point<3>{w, 0.5, 0},
+                                           Vector<3>{double(sign), 0, 0}));
+                }
+        }
+        std::ostringstream log;
+        OracleResult       r = oracleCheck(tree, tris, rays, 1e-9, log);
+        EXPECT_EQ(r.mismatches, 0u) << log.str();
+        EXPECT_GT(r.hits, rays.size() / 2);
+}
+
+TEST(KDTree, FloatEvents) {
+        // events are floats: planes at thirds are not representable, and
+        // the ones 1e-12 apart round to the same event
+        OracleMesh mesh;
+        for (int i = 0; i < 60; i++) {
+                double x = i / 3.0 + (i % 2) * 1e-12;
+                double y = (i % 7) / 3.0, z = (i % 5) / 3.0;
+                mesh.add({x, y, z}, {x, y + 1.0 / 3, z}, {x, y, z + 2.0 / 3});
+                mesh.add({x, y, z}, {x + 1.0 / 3, y + 1e-9, z},
+                         {x + 1.0 / 7, y, z + 1.0 / 3});
+        }
+        mesh.computeBounds();
+        expectMatchesBruteForce(mesh, KDTree::BuildOptions());
+
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree                 tree(mesh.bbox, tris);
+        std::vector<Ray>       rays;
+        for (int i = 0; i < 60; i++) {
+                double y = (i % 7) / 3.0 + 0.01, z = (i % 5) / 3.0 + 0.01;
+                rays.push_back(Ray(Point<3>{-1, y, z}, Vector<3>{1, 0, 0}));
+                rays.push_back(Ray(Point<3>{21, y, z}, Vector<3>{-1, 0, 0}));
+        }
+        std::ostringstream log;
+        OracleResult       r = oracleCheck(tree, tris, rays, 1e-9, log);
+        EXPECT_EQ(r.mismatches, 0u) << log.str();
+        EXPECT_GT(r.hits, 0u);
+}
+
+TEST(KDTree, BinnedSplits) {
+        // the fewest bins, more bins than triangles, and flat meshes whose
+        // triangles all fall on bin boundaries
+        for (unsigned bins : {2u, 7u, 4096u}) {
+                KDTree::BuildOptions binned;
+                binned.bins = bins;
+                expectMatchesBruteForce(oracleSoup(1000, bins), binned);
+                expectMatchesBruteForce(oracleGrid(1000), binned);
+        }
+
+        // binning only approximates the SAH of the exact sweep
+        OracleMesh             mesh = oracleSpheres(4000, 10);
+        std::vector<Triangle*> tris = mesh.pointers();
+        KDTree::BuildOptions   binned;
+        binned.bins = 32;
+        KDTree::Report exact  = KDTree(mesh.bbox, tris).report();
+        KDTree::Report approx = KDTree(mesh.bbox, tris, binned).report();
+        EXPECT_EQ(approx.buildEvents, 0u);
+        EXPECT_GT(exact.buildEvents, 0u);
+        EXPECT_LT(approx.sahCost, exact.sahCost * 1.25);
+}
 
+TEST(KDTree, ClipPolygonToBox) {
+        // straddles x = 1: the part in x >= 1 reaches y = 1 only, while its
+        // bounding box reaches y = 2
+        Triangle t({0, 0, 0}, {2, 0, 0}, {0, 2, 0});
+        Box      V(3, 3, 1, 1, 0, -1);
+        Box      aabb = KDTree::clipTriangleToBox(&t, V);
+        Box      poly = KDTree::clipPolygonToBox(&t, V);
+        EXPECT_TRUE(V.contains(poly));
+        EXPECT_DOUBLE_EQ(aabb.hi[1], 2);
+        EXPECT_DOUBLE_EQ(poly.low[0], 1);
+        EXPECT_DOUBLE_EQ(poly.hi[0], 2);
+        EXPECT_DOUBLE_EQ(poly.low[1], 0);
+        EXPECT_DOUBLE_EQ(poly.hi[1], 1);
+        EXPECT_DOUBLE_EQ(poly.low[2], 0);
+        EXPECT_DOUBLE_EQ(poly.hi[2], 0);
 
-TEST(KDTree, Intersect){
-        
+        // the bounding boxes overlap in [1, 1.5]^2 but the triangle stays
+        // below x + y = 1.5: nothing is left, so the bounding box clip is kept
+        Triangle corner({0, 1.5, 0}, {1.5, 0, 0}, {0, 0, 0});
+        Box      W(2, 2, 1, 1, 1, -1);
+        Box      fallback = KDTree::clipPolygonToBox(&corner, W);
+        Box      expected = KDTree::clipTriangleToBox(&corner, W);
+        for (int k = 0; k < 3; k++) {
+                EXPECT_DOUBLE_EQ(fallback.low[k], expected.low[k]);
+                EXPECT_DOUBLE_EQ(fallback.hi[k], expected.hi[k]);
+        }
+        EXPECT_DOUBLE_EQ(fallback.hi[0], 1.5);
 }
@@ -0,0 +1,284 @@
+#ifndef KDTREE_ORACLE_H
+#define KDTREE_ORACLE_H
+
+//
+// Checks KDTree against the brute-force loop over every Triangle, shared by
+// the KDTree unit tests and the kdtreeOracle tool. Meshes are generated in
+// memory, rays are either random (origins around and inside the mesh, one
+// in eight along an axis) or the primary rays of a Camera looking at it.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Camera.h"
+#include "KDTree2.h"
+#include "PolyObject.h"
+#include "ThreadPool.h"
+#include "ray.h"
+
+namespace RayTracerxx {
+
+/**
+ * @brief      Triangles of a procedural mesh and their bounds
+ */
+struct OracleMesh {
+        std::vector<Triangle> tris;
+        Box                   bbox;
+
+        void add(const Point<3>& a, const Point<3>& b, const Point<3>& c) {
+                tris.push_back(Triangle(a, b, c));
+        }
+
+        std::vector<Triangle*> pointers() {
+                std::vector<Triangle*> result;
+                for (Triangle& tri : tris)
+                        result.push_back(&tri);
+                return result;
+        }
+
+        void computeBounds() {
+                Box b = tris[0].CalcBounds();
+                for (const Triangle& tri : tris) {
+                        Box t = tri.CalcBounds();
+                        for (int k = 0; k < 3; k++) {
+                                b.low[k] = std::min(b.low[k], t.low[k]);
+                                b.hi[k]  = std::max(b.hi[k], t.hi[k]);
+                        }
+                }
+                bbox = b;
+        }
+};
+
+/**
+ * @brief      Overlapping spheres of random sizes, about n triangles
+ */
+inline OracleMesh oracleSpheres(unsigned n, unsigned seed) {
+        std::mt19937_64                        rng(seed);
+        std::uniform_real_distribution<double> u(0, 1);
+        OracleMesh                             mesh;
+        const double                           pi = 3.14159265358979323846;
+
+        unsigned numSpheres = std::max(1u, n / 400);
+        unsigned bands = 10, sectors = std::max(3u, n / numSpheres / 20);
+        for (unsigned s = 0; s < numSpheres; s++) {
+                double c[3] = {u(rng) * 10, u(rng) * 10, u(rng) * 10};
+                double r    = 0.5 + 2 * u(rng);
+                auto   at   = [&](unsigned i, unsigned j) {
+                        double theta = pi * i / bands;
+                        double phi   = 2 * pi * j / sectors;
+                        return Point<3>{
+                            c[0] + r * std::sin(theta) * std::cos(phi),
+                            c[1] + r * std::sin(theta) * std::sin(phi),
+                            c[2] + r * std::cos(theta)};
+                };
+                for (unsigned i = 0; i < bands; i++) {
+                        for (unsigned j = 0; j < sectors; j++) {
+                                mesh.add(at(i, j), at(i + 1, j), at(i + 1, j + 1));
+                                mesh.add(at(i, j), at(i + 1, j + 1), at(i, j + 1));
+                        }
+                }
+        }
+        mesh.computeBounds();
+        return mesh;
+}
+
+/**
+ * @brief      n random triangles in a 10 unit cube, from slivers to large
+ */
+inline OracleMesh oracleSoup(unsigned n, unsigned seed) {
+        std::mt19937_64                        rng(seed);
+        std::uniform_real_distribution<double> u(0, 1);
+        OracleMesh                             mesh;
+
+        for (unsigned i = 0; i < n; i++) {
+                Point<3> a{u(rng) * 10, u(rng) * 10, u(rng) * 10};
+                double   size = std::pow(10.0, -2 + 2.5 * u(rng));
+                Point<3> b{a[0] + size * (u(rng) - 0.5),
+                           a[1] + size * (u(rng) - 0.5),
+                           a[2] + size * (u(rng) - 0.5)};
+                Point<3> c{a[0] + size * (u(rng) - 0.5),
+                           a[1] + size * (u(rng) - 0.5),
+                           a[2] + size * (u(rng) - 0.5)};
+                mesh.add(a, b, c);
+        }
+        mesh.computeBounds();
+        return mesh;
+}
+
+/**
+ * @brief      Axis aligned grids sharing edges and planes, about n triangles
+ *
+ * @details    A ground grid in z = 0 and walls in x = const and y = const
+ *             planes: flat bounding boxes, planar events and ties on shared
+ *             edges, where kd-tree builders and traversals go wrong
+ */
+inline OracleMesh oracleGrid(unsigned n) {
+        OracleMesh mesh;
+        unsigned   side = std::max(2u, unsigned(std::sqrt(n / 4.0)));
+        double     step = 10.0 / side;
+
+        for (unsigned i = 0; i < side; i++) {
+                for (unsigned j = 0; j < side; j++) {
+                        double x = i * step, y = j * step;
+                        mesh.add({x, y, 0}, {x + step, y, 0},
+                                 {x + step, y + step, 0});
+                        mesh.add({x, y, 0}, {x + step, y + step, 0},
+                                 {x, y + step, 0});
+                }
+        }
+        // walls every other column, half height
+        for (unsigned i = 0; i < side; i += 2) {
+                for (unsigned j = 0; j < side / 2; j++) {
+                        double w = i * step, z = j * step;
+                        mesh.add({w, 0, z}, {w, 10, z}, {w, 10, z + step});
+                        mesh.add({w, 0, z}, {w, 10, z + step}, {w, 0, z + step});
+                        mesh.add({0, w, z}, {10, w, z}, {10, w, z + step});
+                        mesh.add({0, w, z}, {10, w, z + step}, {0, w, z + step});
+                }
+        }
+        mesh.computeBounds();
+        return mesh;
+}
+
+/**
+ * @brief      Rays starting anywhere in the mesh bounds grown by half their
+ *             size, in uniformly random directions. One in eight runs along
+ *             an axis
+ */
+inline std::vector<Ray> oracleRandomRays(const Box& b, size_t n,
+                                         unsigned seed) {
+        std::mt19937_64                        rng(seed);
+        std::uniform_real_distribution<double> u(0, 1);
+        std::normal_distribution<double>       g(0, 1);
+        std::vector<Ray>                       rays;
+
+        rays.reserve(n);
+        while (rays.size() < n) {
+                Point<3>  origin;
+                Vector<3> direction{g(rng), g(rng), g(rng)};
+                for (int k = 0; k < 3; k++)
+                        origin[k] = b.low[k] + b.d(k) * (1.5 * u(rng) - 0.25);
+                if (rays.size() % 8 == 7) {
+                        direction        = Vector<3>{0, 0, 0};
+                        direction[rng() % 3] = u(rng) < 0.5 ? -1 : 1;
+                }
+                if (direction.norm() == 0)
+                        continue;
+                direction.normalize();
+                rays.push_back(Ray(origin, direction));
+        }
+        return rays;
+}
+
+/**
+ * @brief      Primary rays of a width x height Camera looking down -z at the
+ *             whole mesh, as the benchmarks place it
+ */
+inline std::vector<Ray> oracleCameraRays(const Box& b, unsigned width,
+                                         unsigned height) {
+        Camera camera(width, height);
+        camera.setPosition(
+            (b.hi[0] + b.low[0]) / 2, (b.hi[1] + b.low[1]) / 2,
+            b.hi[2] + 0.6 * std::max(b.hi[0] - b.low[0], b.hi[1] - b.low[1]));
+
+        std::vector<Ray> rays;
+        rays.reserve(size_t(width) * height);
+        for (unsigned y = 0; y < height; y++)
+                for (unsigned x = 0; x < width; x++)
+                        rays.push_back(camera.getRay(x, y));
+        return rays;
+}
+
+/**
+ * @brief      Outcome of checking a tree against brute force
+ */
+struct OracleResult {
+        size_t rays;
+        size_t hits;
+        size_t ties;        // same t, another triangle (shared edges)
+        size_t mismatches;  // nearest hit or occlusion disagreed
+        double treeSeconds, bruteSeconds;  // nearest hit queries only
+
+        double speedup() const {
+                return treeSeconds > 0 ? bruteSeconds / treeSeconds : 0;
+        }
+};
+
+/**
+ * @brief      Traces every ray through the tree and through every triangle
+ *
+ * @details    The nearest hit must agree: both a hit or both a miss, and
+ *             the same t within tolerance (relative beyond 1). Another
+ *             triangle at the same t counts as a tie, not a mismatch. Rays
+ *             that hit are also asked Occluded with tmax half and twice the
+ *             nearest t, which must answer false and true. The first
+ *             mismatches are printed to log
+ *
+ * @param[in]  tree       The tree
+ * @param[in]  tris       All the triangles of the tree
+ * @param[in]  rays       The rays
+ * @param[in]  tolerance  The tolerance on t
+ * @param      log        Where to describe mismatches
+ *
+ * @return     The counts and timings
+ */
+inline OracleResult oracleCheck(const KDTree&                 tree,
+                                const std::vector<Triangle*>& tris,
+                                const std::vector<Ray>& rays,
+                                Number_t tolerance, std::ostream& log) {
+        using namespace std::chrono;
+        std::vector<Ray> fromTree(rays), fromBrute(rays);
+        OracleResult     r = {rays.size(), 0, 0, 0, 0, 0};
+
+        auto start = steady_clock::now();
+        parallelFor(0, rays.size(), 1024, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++)
+                        tree.Intersect(fromTree[i]);
+        });
+        r.treeSeconds = duration<double>(steady_clock::now() - start).count();
+
+        start = steady_clock::now();
+        parallelFor(0, rays.size(), 64, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++)
+                        for (const Triangle* tri : tris)
+                                tri->Intersect(fromBrute[i]);
+        });
+        r.bruteSeconds = duration<double>(steady_clock::now() - start).count();
+
+        for (size_t i = 0; i < rays.size(); i++) {
+                const Ray& t = fromTree[i];
+                const Ray& b = fromBrute[i];
+                bool       ok;
+                if (b.hit == NULL or t.hit == NULL)
+                        ok = b.hit == t.hit;
+                else
+                        ok = std::fabs(t.t - b.t) <=
+                             tolerance * std::max<Number_t>(1, std::fabs(b.t));
+
+                if (ok and b.hit != NULL) {
+                        r.hits++;
+                        r.ties += t.hit != b.hit;
+
+                        Ray shadow(rays[i]);
+                        ok = not tree.Occluded(shadow, b.t / 2);
+                        shadow = rays[i];
+                        ok     = ok and tree.Occluded(shadow, b.t * 2);
+                }
+                if (not ok and r.mismatches++ < 5)
+                        log << "Ray " << i << " from " << rays[i].origin
+                            << " along " << rays[i].direction << ": kd-tree "
+                            << (t.hit ? "hit" : "miss") << " t " << t.t
+                            << ", brute force " << (b.hit ? "hit" : "miss")
+                            << " t " << b.t << "\n";
+        }
+        return r;
+}
+
+}  // namespace RayTracerxx
+
+#endif
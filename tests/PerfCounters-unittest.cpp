@@ -0,0 +1,50 @@
+#include "PerfCounters.h"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include "ThreadPool.h"
+
+TEST(PerfCounters, Phases) {
+        using RayTracerxx::PerfCounters;
+        using RayTracerxx::PerfScope;
+
+        PerfCounters& counters = PerfCounters::instance();
+        RayTracerxx::ThreadPool::instance().start(3);
+        counters.enable(true);
+        counters.reset(RayTracerxx::ThreadPool::instance().size());
+
+        // tasks queued in a phase are counted in that phase, by any thread
+        volatile double sink = 0;
+        {
+                PerfScope build(PerfCounters::BUILD);
+                EXPECT_EQ(PerfCounters::currentPhase(), PerfCounters::BUILD);
+                RayTracerxx::parallelFor(0, 64, 1, [&](size_t first,
+                                                       size_t last) {
+                        EXPECT_EQ(PerfCounters::currentPhase(),
+                                  PerfCounters::BUILD);
+                        double x = 0;
+                        for (size_t i = first * 100000; i < last * 100000; i++)
+                                x += std::sqrt(double(i));
+                        sink = sink + x;
+                });
+        }
+        EXPECT_EQ(PerfCounters::currentPhase(), PerfCounters::NONE);
+        counters.enable(false);
+        RayTracerxx::ThreadPool::instance().start(1);
+
+        EXPECT_GT(counters.seconds(PerfCounters::BUILD), 0);
+        EXPECT_EQ(counters.seconds(PerfCounters::PRIMARY), 0);
+        if (counters.hardware())
+                EXPECT_GT(counters.count(PerfCounters::BUILD,
+                                         PerfCounters::INSTRUCTIONS),
+                          6400000);
+        else
+                EXPECT_EQ(counters.count(PerfCounters::BUILD,
+                                         PerfCounters::CYCLES),
+                          -1);
+
+        std::ostringstream out;
+        counters.print(out, PerfCounters::BUILD, PerfCounters::SHADING);
+        EXPECT_NE(out.str().find("shading"), std::string::npos) << out.str();
+}
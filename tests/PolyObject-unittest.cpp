@@ -0,0 +1,89 @@
+#include "PolyObject.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "Scene.h"
+
+using namespace RayTracerxx;
+
+/**
+ * @brief      Writes an ASCII ply file of unit right triangles in z = 0, the
+ *             i-th with its corner at (x0 + 2i, 0) and the i-th color
+ */
+static void writePly(const std::string& filename, double x0,
+                     const std::vector<std::string>& colors) {
+        std::ofstream out(filename.c_str());
+        out << "ply\nformat ascii 1.0\n"
+            << "element vertex " << 3 * colors.size() << "\n"
+            << "property float x\nproperty float y\nproperty float z\n"
+            << "element face " << colors.size() << "\n"
+            << "property list uchar int vertex_indices\n"
+            << "property uchar red\nproperty uchar green\n"
+            << "property uchar blue\nend_header\n";
+        for (size_t i = 0; i < colors.size(); i++) {
+                double x = x0 + 2 * i;
+                out << x << " 0 0\n"
+                    << x + 1 << " 0 0\n"
+                    << x << " 1 0\n";
+        }
+        for (size_t i = 0; i < colors.size(); i++)
+                out << "3 " << 3 * i << " " << 3 * i + 1 << " " << 3 * i + 2
+                    << " " << colors[i] << "\n";
+}
+
+/**
+ * @brief      Gets the triangle straight below (x, 0.25)
+ */
+static const Triangle* hitBelow(const KDTree* tree, double x) {
+        Ray ray(Point<3>{x, 0.25, 1}, Vector<3>{0, 0, -1});
+        tree->Intersect(ray);
+        return ray.hit;
+}
+
+TEST(PolyObject, FaceColors) {
+        const std::string filename = "PolyObject-unittest.ply";
+        writePly(filename, 0, {"255 0 0", "0 0 255", "255 0 0"});
+        PolyObject object(filename);
+        std::remove(filename.c_str());
+
+        ASSERT_EQ(object.mesh.size(), 3u);
+        EXPECT_DOUBLE_EQ(object.mesh[1].vertex[0][0], 2);
+
+        // the default material, then one per distinct color
+        ASSERT_EQ(object.materials.size(), 3u);
+        EXPECT_EQ(object.mesh[0].material, object.mesh[2].material);
+        const Material& red  = object.materials[object.mesh[0].material];
+        const Material& blue = object.materials[object.mesh[1].material];
+        EXPECT_DOUBLE_EQ(red.color[0], 255);
+        EXPECT_DOUBLE_EQ(red.color[2], 0);
+        EXPECT_DOUBLE_EQ(blue.color[2], 255);
+}
+
+TEST(Scene, AddObjectMaterials) {
+        // the second object's material indices follow the first one's
+        const std::string first = "Scene-unittest-1.ply";
+        const std::string second = "Scene-unittest-2.ply";
+        writePly(first, 0, {"255 0 0", "0 255 0"});
+        writePly(second, 10, {"0 0 255", "0 255 0"});
+
+        Scene scene(4, 4);
+        scene.addObject(PolyObject(first));
+        scene.addObject(PolyObject(second));
+        std::remove(first.c_str());
+        std::remove(second.c_str());
+
+        const KDTree* tree = scene.getTree();
+        ASSERT_NE(tree, nullptr);
+        const double x[4]        = {0.25, 2.25, 10.25, 12.25};
+        const int    channel[4] = {0, 1, 2, 1};
+        for (int i = 0; i < 4; i++) {
+                const Triangle* hit = hitBelow(tree, x[i]);
+                ASSERT_NE(hit, nullptr) << "triangle " << i;
+                const Material& material = scene.getMaterial(*hit);
+                for (int k = 0; k < 3; k++)
+                        EXPECT_DOUBLE_EQ(material.color[k],
+                                         k == channel[i] ? 255 : 0)
+                            << "triangle " << i << " channel " << k;
+        }
+}
@@ -0,0 +1,86 @@
+#include "RayCapture.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+TEST(RayCapture, WriteAndLoad) {
+        using RayTracerxx::CapturedRay;
+        using RayTracerxx::Number_t;
+        using RayTracerxx::Ray;
+        using RayTracerxx::RayCapture;
+
+        const std::string filename = "RayCapture-unittest.bin";
+        RayCapture&       capture  = RayCapture::instance();
+        capture.start(filename);
+        capture.reset(RayTracerxx::ThreadPool::instance().size());
+
+        Number_t origin[3] = {1, 2, 3}, direction[3] = {0, 0, -1};
+        Ray      primary(origin, direction);
+        primary.t = 2.5;
+        capture.record(CapturedRay::PRIMARY, primary, Ray::Infinity, true);
+        Ray shadow(origin, direction);
+        capture.record(CapturedRay::SHADOW, shadow, 7, false);
+
+        EXPECT_EQ(capture.write(), 2u);
+        capture.stop();
+
+        std::vector<CapturedRay> rays;
+        ASSERT_TRUE(RayCapture::load(filename, rays));
+        std::remove(filename.c_str());
+        ASSERT_EQ(rays.size(), 2u);
+
+        EXPECT_EQ(rays[0].kind, CapturedRay::PRIMARY);
+        EXPECT_EQ(rays[0].hit, 1u);
+        EXPECT_EQ(rays[0].t, 2.5);
+        EXPECT_EQ(rays[0].origin[2], 3);
+        EXPECT_EQ(rays[0].direction[2], -1);
+
+        EXPECT_EQ(rays[1].kind, CapturedRay::SHADOW);
+        EXPECT_EQ(rays[1].hit, 0u);
+        EXPECT_EQ(rays[1].tmax, 7);
+        EXPECT_EQ(rays[1].t, Number_t(Ray::Infinity));
+
+        Ray replayed = rays[1].toRay();
+        EXPECT_EQ(replayed.origin[1], 2);
+        EXPECT_TRUE(replayed.isNeg[2]);
+
+        EXPECT_FALSE(RayCapture::load("missing.bin", rays));
+}
+
+TEST(RayCapture, LoadTruncated) {
+        using RayTracerxx::CapturedRay;
+        using RayTracerxx::RayCapture;
+
+        const std::string filename = "RayCapture-truncated.bin";
+        auto writeCapture = [&](uint64_t count, size_t stored) {
+                std::ofstream out(filename.c_str(), std::ios::binary);
+                out.write(RayCapture::magic, 8);
+                out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+                std::vector<CapturedRay> rays(stored);
+                out.write(reinterpret_cast<const char*>(rays.data()),
+                          stored * sizeof(CapturedRay));
+        };
+        std::vector<CapturedRay> rays;
+
+        writeCapture(3, 3);
+        EXPECT_TRUE(RayCapture::load(filename, rays));
+        EXPECT_EQ(rays.size(), 3u);
+
+        // a header promising more rays than stored, or absurdly many
+        writeCapture(4, 3);
+        EXPECT_FALSE(RayCapture::load(filename, rays));
+        writeCapture(uint64_t(1) << 62, 1);
+        EXPECT_FALSE(RayCapture::load(filename, rays));
+
+        // the header alone is cut short
+        {
+                std::ofstream out(filename.c_str(), std::ios::binary);
+                out.write(RayCapture::magic, 8);
+                out.write("\x01\x00", 2);
+        }
+        EXPECT_FALSE(RayCapture::load(filename, rays));
+        std::remove(filename.c_str());
+}
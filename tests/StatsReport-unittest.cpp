@@ -0,0 +1,86 @@
+#include "StatsReport.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <sstream>
+#include <string>
+#include "Log.h"
+
+using RayTracerxx::Log;
+using RayTracerxx::ObjectStats;
+using RayTracerxx::RenderStats;
+using RayTracerxx::StatsReport;
+
+TEST(StatsReport, Print) {
+        StatsReport& report = StatsReport::instance();
+        std::ostringstream empty;
+        report.print(empty);
+        EXPECT_NE(empty.str().find("\"objects\": []"), std::string::npos);
+        EXPECT_NE(empty.str().find("\"renders\": []"), std::string::npos);
+
+        report.addObject(ObjectStats{"dir/a \"b\".ply", 1200, 0.25});
+        RenderStats render;
+        render.output        = "out.ppm";
+        render.width         = 4;
+        render.height        = 2;
+        render.rebuilt       = true;
+        render.renderSeconds = 0.5;
+        render.primaryRays   = 8;
+        render.shadowRays    = 12;
+        report.addRender(render);
+        EXPECT_DOUBLE_EQ(render.raysPerSecond(), 40);
+
+        std::ostringstream out;
+        report.print(out);
+        const std::string json = out.str();
+        EXPECT_NE(json.find("\"file\": \"dir/a \\\"b\\\".ply\""),
+                  std::string::npos)
+            << json;
+        EXPECT_NE(json.find("\"triangles\": 1200"), std::string::npos);
+        EXPECT_NE(json.find("\"rebuilt\": true"), std::string::npos);
+        EXPECT_NE(json.find("\"rays_per_second\": 40"), std::string::npos);
+        EXPECT_GT(StatsReport::peakRSS(), 0u);
+
+        // not started, so there is no file to write
+        EXPECT_FALSE(report.enabled());
+        EXPECT_FALSE(report.write());
+}
+
+TEST(Log, Verbosity) {
+        EXPECT_TRUE(Log::enabled(Log::INFO));
+        EXPECT_FALSE(Log::enabled(Log::DETAIL));
+
+        // discarded messages are not even formatted
+        EXPECT_TRUE(Log::out(Log::DETAIL).bad());
+        Log::setVerbosity(Log::QUIET);
+        EXPECT_TRUE(Log::out(Log::INFO).bad());
+        Log::setVerbosity(Log::DETAIL);
+        EXPECT_EQ(&Log::out(Log::DETAIL), &std::cerr);
+        Log::setVerbosity(Log::INFO);
+}
+
+TEST(StatsReport, Escaping) {
+        StatsReport& report = StatsReport::instance();
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        report.addObject(ObjectStats{"tab\tnew\nline\x01\x1f", 3, nan});
+        RenderStats render;
+        render.output       = "inf.ppm";
+        render.buildSeconds = std::numeric_limits<double>::infinity();
+
+        std::ostringstream out;
+        report.print(out);
+        const std::string json = out.str();
+        EXPECT_NE(json.find("\"file\": \"tab\\tnew\\nline\\u0001\\u001f\""),
+                  std::string::npos)
+            << json;
+        EXPECT_NE(json.find("\"load_seconds\": null"), std::string::npos)
+            << json;
+        EXPECT_EQ(json.find("nan"), std::string::npos) << json;
+
+        report.addRender(render);
+        std::ostringstream withRender;
+        report.print(withRender);
+        EXPECT_NE(withRender.str().find("\"build_seconds\": null"),
+                  std::string::npos)
+            << withRender.str();
+        EXPECT_EQ(withRender.str().find("inf,"), std::string::npos);
+}
@@ -0,0 +1,206 @@
+#include "ThreadPool.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(ThreadPool, ParallelFor) {
+        using RayTracerxx::ThreadPool;
+        using RayTracerxx::parallelFor;
+
+        ThreadPool::instance().start(4);
+
+        std::vector<int> visits(10000, 0);
+        parallelFor(0, visits.size(), 64, [&](size_t first, size_t last) {
+                EXPECT_LE(last - first, 64u) << "chunks must respect grain";
+                for (size_t i = first; i < last; i++)
+                        visits[i]++;
+        });
+
+        for (size_t i = 0; i < visits.size(); i++)
+                ASSERT_EQ(visits[i], 1) << "index " << i << " visited "
+                                        << visits[i] << " times";
+
+        ThreadPool::instance().start(1);
+}
+
+TEST(ThreadPool, NestedGroups) {
+        using RayTracerxx::TaskGroup;
+        using RayTracerxx::ThreadPool;
+
+        ThreadPool::instance().start(3);
+        ThreadPool::instance().resetStats();
+
+        // Recursive sum: tasks spawn and wait on their own groups
+        std::vector<long> values(1 << 12);
+        std::iota(values.begin(), values.end(), 1);
+
+        std::function<long(size_t, size_t)> sum = [&](size_t b, size_t e) {
+                if (e - b <= 16)
+                        return std::accumulate(values.begin() + b,
+                                               values.begin() + e, 0L);
+                long      left = 0, right = 0;
+                TaskGroup group;
+                group.run([&]() { left = sum(b, (b + e) / 2); });
+                right = sum((b + e) / 2, e);
+                group.wait();
+                return left + right;
+        };
+
+        long n = values.size();
+        EXPECT_EQ(sum(0, values.size()), n * (n + 1) / 2);
+
+        unsigned long long executed = 0;
+        for (const auto& s : ThreadPool::instance().stats())
+                executed += s.executed;
+        EXPECT_EQ(executed, (unsigned long long)values.size() / 16 - 1)
+            << "every spawned task should run exactly once";
+
+        ThreadPool::instance().start(1);
+}
+
+TEST(ThreadPool, SingleThread) {
+        using RayTracerxx::TaskGroup;
+        using RayTracerxx::ThreadPool;
+
+        // A single slot pool runs tasks on the waiting thread
+        EXPECT_EQ(ThreadPool::instance().size(), 1u);
+
+        std::atomic<int> count(0);
+        {
+                TaskGroup group;
+                for (int i = 0; i < 10; i++)
+                        group.run([&]() { count++; });
+        }
+        EXPECT_EQ(count, 10);
+}
+
+TEST(ThreadPool, ParallelSort) {
+        using RayTracerxx::ThreadPool;
+        using RayTracerxx::parallelSort;
+
+        ThreadPool::instance().start(3);
+
+        // enough elements for several runs and an odd number of merges
+        std::vector<unsigned> values(5 * (1 << 16) + 123);
+        unsigned              x = 12345;
+        for (unsigned &v : values)
+                v = (x = x * 1103515245u + 12345u) >> 8;
+
+        std::vector<unsigned> expected(values);
+        std::sort(expected.begin(), expected.end());
+
+        parallelSort(values, std::less<unsigned>());
+        EXPECT_EQ(values, expected);
+
+        ThreadPool::instance().start(1);
+}
+
+TEST(ThreadPool, IdleTime) {
+        using RayTracerxx::ThreadPool;
+
+        ThreadPool::instance().start(3, true);
+        EXPECT_TRUE(ThreadPool::instance().pinned());
+
+        // workers with nothing to do are asleep; their wait counts from the
+        // reset, and is counted before it ends
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ThreadPool::instance().resetStats();
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::vector<ThreadPool::WorkerStats> stats =
+            ThreadPool::instance().stats();
+        double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+        ASSERT_EQ(stats.size(), 3u);
+        for (size_t i = 1; i < stats.size(); i++) {
+                EXPECT_GE(stats[i].idleSeconds, 0.09) << "worker " << i;
+                EXPECT_LE(stats[i].idleSeconds, elapsed + 0.01)
+                    << "worker " << i;
+        }
+
+        ThreadPool::instance().start(1);
+        EXPECT_FALSE(ThreadPool::instance().pinned());
+}
+
+TEST(ThreadPool, Exceptions) {
+        using RayTracerxx::TaskGroup;
+        using RayTracerxx::ThreadPool;
+        using RayTracerxx::parallelFor;
+
+        ThreadPool::instance().start(4);
+
+        // every task runs, and the first exception comes out of wait()
+        std::atomic<int> ran(0);
+        {
+                TaskGroup group;
+                for (int i = 0; i < 64; i++)
+                        group.run([&ran, i] {
+                                ran++;
+                                if (i % 8 == 3)
+                                        throw std::runtime_error("task");
+                        });
+                EXPECT_THROW(group.wait(), std::runtime_error);
+                EXPECT_EQ(ran, 64);
+                EXPECT_NO_THROW(group.wait()) << "rethrown only once";
+        }
+
+        // from nested groups, and the pool is still usable afterwards
+        auto nested = [](size_t first, size_t) {
+                parallelFor(0, 10, 1, [first](size_t, size_t) {
+                        if (first == 500)
+                                throw std::bad_alloc();
+                });
+        };
+        EXPECT_THROW(parallelFor(0, 1000, 10, nested), std::bad_alloc);
+
+        std::atomic<size_t> sum(0);
+        parallelFor(0, 1000, 10, [&sum](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++)
+                        sum += i;
+        });
+        EXPECT_EQ(sum, 999u * 1000 / 2);
+
+        ThreadPool::instance().start(1);
+}
+
+TEST(ThreadPool, StatsWhileRunning) {
+        using RayTracerxx::ThreadPool;
+        using RayTracerxx::parallelFor;
+
+        ThreadPool::instance().start(3);
+
+        // reading and clearing the counters from another thread is safe,
+        // and so is running tasks from a thread outside the pool
+        std::atomic<bool> done(false);
+        std::thread       reader([&done] {
+                while (not done) {
+                        ThreadPool::instance().stats();
+                        ThreadPool::instance().resetStats();
+                }
+        });
+        std::thread outside([] {
+                parallelFor(0, 2000, 1, [](size_t, size_t) {});
+        });
+        for (int i = 0; i < 20; i++)
+                parallelFor(0, 2000, 1, [](size_t, size_t) {});
+        outside.join();
+        done = true;
+        reader.join();
+
+        ThreadPool::instance().resetStats();
+        parallelFor(0, 100, 1, [](size_t, size_t) {});
+        unsigned long long executed = 0;
+        for (const ThreadPool::WorkerStats& s : ThreadPool::instance().stats())
+                executed += s.executed;
+        EXPECT_EQ(executed, 100u);
+
+        ThreadPool::instance().start(1);
+}
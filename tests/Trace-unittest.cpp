@@ -0,0 +1,43 @@
+#include "Trace.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "ThreadPool.h"
+
+TEST(Tracer, Write) {
+        using RayTracerxx::TraceScope;
+        using RayTracerxx::Tracer;
+
+        const std::string filename = "Trace-unittest.json";
+        { TraceScope ignored("before start"); }
+
+        Tracer::instance().start(filename);
+        RayTracerxx::ThreadPool::instance().start(3);
+        RayTracerxx::parallelFor(0, 64, 1, [&](size_t first, size_t last) {
+                TraceScope scope("task", "first", first);
+                (void)last;
+        });
+        { TraceScope skipped(NULL); }
+        Tracer::instance().stop();
+        RayTracerxx::ThreadPool::instance().start(1);
+
+        std::ifstream      in(filename.c_str());
+        std::ostringstream text;
+        text << in.rdbuf();
+        std::string trace = text.str();
+        std::remove(filename.c_str());
+
+        EXPECT_EQ(trace.find("before start"), std::string::npos);
+        EXPECT_NE(trace.find("\"traceEvents\""), std::string::npos);
+        EXPECT_NE(trace.find("\"name\": \"main\""), std::string::npos);
+        EXPECT_NE(trace.find("\"args\": {\"first\": 63}"), std::string::npos);
+
+        // one complete event per task
+        size_t count = 0;
+        for (size_t p = trace.find("\"ph\": \"X\""); p != std::string::npos;
+             p        = trace.find("\"ph\": \"X\"", p + 1))
+                count++;
+        EXPECT_EQ(count, 64u);
+}
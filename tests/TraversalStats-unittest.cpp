@@ -0,0 +1,48 @@
+#include "TraversalStats.h"
+#include <gtest/gtest.h>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "ThreadPool.h"
+
+TEST(TraversalStats, Record) {
+        using RayTracerxx::RayCounters;
+        using RayTracerxx::TraversalStats;
+        using RayTracerxx::parallelFor;
+
+        TraversalStats& stats = TraversalStats::instance();
+        RayTracerxx::ThreadPool::instance().start(3);
+        stats.reset(RayTracerxx::ThreadPool::instance().size());
+
+        // ray i visits i inner nodes, from every thread of the pool
+        parallelFor(1, 101, 4, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                        RayCounters c;
+                        c.inner = i;
+                        c.tris  = 2;
+                        stats.record(TraversalStats::PRIMARY, c);
+                }
+        });
+
+        EXPECT_EQ(stats.numRays(TraversalStats::PRIMARY), 100u);
+        EXPECT_EQ(stats.numRays(TraversalStats::SHADOW), 0u);
+
+        std::ostringstream out;
+        stats.print(out);
+        // total 5050, mean 50.50, p50 50, p90 90, p99 99, max 100
+        EXPECT_NE(out.str().find("5050     50.50     50     90     99     100"),
+                  std::string::npos)
+            << out.str();
+
+        // the caller's formatting is left as it was
+        std::ostringstream formatted;
+        formatted << std::scientific << std::setprecision(5);
+        stats.print(formatted);
+        EXPECT_EQ(formatted.precision(), 5);
+        EXPECT_EQ(formatted.flags() & std::ios::floatfield,
+                  std::ios::scientific);
+        EXPECT_EQ(formatted.flags() & std::ios::adjustfield,
+                  std::ios::fmtflags(0));
+
+        RayTracerxx::ThreadPool::instance().start(1);
+}
@@ -47,3 +47,57 @@ TEST(Triangle, Intersect) {
         tri0.Intersect(ray2);
         EXPECT_EQ(ray2.hit, nullptr) << "ray2 should miss tri0!";
 }
+
+TEST(Triangle, Accel) {
+        using RayTracerxx::Point;
+        using RayTracerxx::Ray;
+        using RayTracerxx::TriAccel;
+        using RayTracerxx::Triangle;
+
+        Triangle tri({1.0, 0.0, 1.0}, {1.5, 0.5, 1.0}, {1.25, 1.0, 1.5});
+        TriAccel acc = tri.accel();
+
+        // the record finds the same t as the triangle, without setting hit
+        Ray ray({90.0, 100.0, -110.0}, {-88.75, -99.5, 111.1666});
+        ray.direction.normalize();
+        Ray copy(ray);
+        tri.Intersect(ray);
+        ASSERT_EQ(ray.hit, &tri);
+        EXPECT_TRUE(acc.Intersect(copy));
+        EXPECT_EQ(copy.t, ray.t);
+        EXPECT_EQ(copy.hit, nullptr);
+
+        // a hit further than t is not taken
+        EXPECT_FALSE(acc.Intersect(copy));
+        copy.t = ray.t / 2;
+        EXPECT_FALSE(acc.Intersect(copy));
+        EXPECT_EQ(copy.t, ray.t / 2);
+
+        // the edges are floats but the vertex is not: a small triangle far
+        // from the origin is hit where it is, not where floats would put it
+        Triangle far({1e6 + 0.1, 0, 0}, {1e6 + 0.4, 0, 0}, {1e6 + 0.1, 0.3, 0});
+        Ray      down({1e6 + 0.2, 0.1, 2.5}, {0.0, 0.0, -1.0});
+        EXPECT_TRUE(far.accel().Intersect(down));
+        EXPECT_NEAR(down.t, 2.5, 1e-12);
+        Ray beside({1e6 + 0.05, 0.1, 2.5}, {0.0, 0.0, -1.0});
+        EXPECT_FALSE(far.accel().Intersect(beside));
+}
+
+TEST(Triangle, Materials) {
+        using RayTracerxx::Material;
+        using RayTracerxx::Triangle;
+
+        std::vector<Triangle> mesh(4);
+        std::vector<Material> materials(1);
+        EXPECT_DOUBLE_EQ(materials[0].color[0], 127);
+        EXPECT_DOUBLE_EQ(materials[0].ka[0], 12.7);
+
+        // one material per distinct color, after the default
+        std::vector<uint8_t> color = {255, 0, 0, 0, 0, 255, 255, 0, 0, 0, 0, 255};
+        RayTracerxx::setColors(mesh, materials, color);
+        ASSERT_EQ(materials.size(), 3u);
+        EXPECT_EQ(mesh[0].material, 1u);
+        EXPECT_EQ(mesh[1].material, 2u);
+        EXPECT_EQ(mesh[2].material, 1u);
+        EXPECT_DOUBLE_EQ(materials[mesh[3].material].color[2], 255);
+}
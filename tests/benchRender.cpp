@@ -0,0 +1,198 @@
+//
+// End-to-end benchmark of one scene, run by `make bench` for every scene of
+// BENCH_SCENES. Every repetition rebuilds the kd-tree, traces the primary
+// rays of the camera, then the shadow rays of every hit, then renders the
+// whole image (shading included), and reports the median, minimum, maximum
+// and spread of each measure, and the peak resident memory.
+//
+// Usage: benchRender scene.ply [options]
+//
+//   --repeat N     repetitions (default 5)
+//   --size WxH     image size (default 640x360)
+//   --threads N    ThreadPool size (default 0, all cores)
+//   --binned N     build the kd-tree with N bins (default exact SAH)
+//
+// The camera looks down -z at the whole mesh, lit by the lights of the
+// scenes generateScene writes (BenchLights.h).
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BenchLights.h"
+#include "KDTree2.h"
+#include "Log.h"
+#include "PolyObject.h"
+#include "Scene.h"
+#include "StatsReport.h"
+#include "ThreadPool.h"
+
+using namespace RayTracerxx;
+
+struct ShadowQuery {
+        Ray      ray;
+        Number_t tmax;
+};
+
+/**
+ * @brief      Times a function
+ *
+ * @return     Seconds
+ */
+template <class Function>
+double seconds(Function f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+}
+
+/**
+ * @brief      Prints the median, minimum, maximum and spread ((max - min) /
+ *             median) of the samples
+ */
+void summary(const std::string& name, std::vector<double> samples) {
+        std::sort(samples.begin(), samples.end());
+        size_t n      = samples.size();
+        double median = n % 2 ? samples[n / 2]
+                              : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+        double spread = median > 0 ? (samples.back() - samples[0]) / median : 0;
+
+        std::cout << "  " << std::left << std::setw(18) << name << std::right
+            << std::fixed << std::setprecision(3) << std::setw(11) << median
+            << std::setw(11) << samples[0] << std::setw(11) << samples.back()
+            << std::setprecision(1) << std::setw(9) << 100 * spread << "%\n";
+}
+
+int main(int argc, char* argv[]) {
+        std::string          ply;
+        unsigned             repeat = 5, threads = 0, width = 640, height = 360;
+        KDTree::BuildOptions opts;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--repeat" and i + 1 < argc)
+                        repeat = std::max(1, std::atoi(argv[++i]));
+                else if (arg == "--size" and i + 1 < argc)
+                        std::sscanf(argv[++i], "%ux%u", &width, &height);
+                else if (arg == "--threads" and i + 1 < argc)
+                        threads = std::atoi(argv[++i]);
+                else if (arg == "--binned" and i + 1 < argc)
+                        opts.bins = std::atoi(argv[++i]);
+                else
+                        ply = arg;
+        }
+        if (ply.empty() or width == 0 or height == 0) {
+                std::cerr << "Usage: benchRender scene.ply [--repeat N] "
+                             "[--size WxH] [--threads N] [--binned N]\n";
+                return 2;
+        }
+
+        Log::setVerbosity(Log::QUIET);
+
+        ThreadPool::instance().start(threads);
+        Scene      scene(width, height);
+        PolyObject object(ply);
+        size_t     numTris = object.mesh.size();
+        if (numTris == 0) {
+                std::cerr << "No triangles in " << ply << "\n";
+                return 1;
+        }
+
+        const Box& b = object.bbox;
+        scene.addObject(object);
+        scene.camera.setPosition(
+            (b.hi[0] + b.low[0]) / 2, (b.hi[1] + b.low[1]) / 2,
+            b.hi[2] + 0.6 * std::max(b.hi[0] - b.low[0], b.hi[1] - b.low[1]));
+
+        std::vector<Point<3>> lights;
+        for (const BenchLight& light : benchLights) {
+                const int*    p = light.position;
+                const double* c = light.color;
+                lights.push_back(Point<3>{Number_t(p[0]), Number_t(p[1]),
+                                          Number_t(p[2])});
+                scene.addLight({Number_t(p[0]), Number_t(p[1]), Number_t(p[2])},
+                               {c[0], c[1], c[2]});
+        }
+        scene.setBuildOptions(opts);
+
+        std::vector<double> build, primary, shadow, render;
+        size_t              numShadows = 0;
+        for (unsigned r = 0; r < repeat; r++) {
+                const KDTree* tree = NULL;
+                scene.setBuildOptions(opts);  // forces a rebuild
+                build.push_back(1e3 * seconds([&] { tree = scene.getTree(); }));
+
+                std::vector<Ray> rays;
+                rays.reserve(width * height);
+                for (unsigned y = 0; y < height; y++)
+                        for (unsigned x = 0; x < width; x++)
+                                rays.push_back(scene.camera.getRay(x, y));
+
+                double t = seconds([&] {
+                        parallelFor(0, rays.size(), 4096,
+                                    [&](size_t first, size_t last) {
+                                            for (size_t i = first; i < last;
+                                                 i++)
+                                                    tree->Intersect(rays[i]);
+                                    });
+                });
+                primary.push_back(rays.size() / t / 1e6);
+
+                // shadow rays are built as Scene::traceShadows does
+                std::vector<ShadowQuery> queries;
+                for (Ray& ray : rays) {
+                        if (ray.hit == NULL)
+                                continue;
+                        Point<3> inter =
+                            ray.intersection() +
+                            (ray.hit->normal * ray.intersectionBias);
+                        for (const Point<3>& light : lights) {
+                                Vector<3> toLight(light - inter);
+                                ShadowQuery q = {Ray(inter, toLight),
+                                                 toLight.norm()};
+                                q.ray.direction.normalize();
+                                queries.push_back(q);
+                        }
+                }
+                numShadows = queries.size();
+
+                t = seconds([&] {
+                        parallelFor(0, queries.size(), 4096,
+                                    [&](size_t first, size_t last) {
+                                            for (size_t i = first; i < last;
+                                                 i++)
+                                                    tree->Occluded(
+                                                        queries[i].ray,
+                                                        queries[i].tmax);
+                                    });
+                });
+                shadow.push_back(queries.size() / t / 1e6);
+
+                render.push_back(1e3 * seconds([&] { scene.renderScene(); }));
+        }
+
+        std::cout << "Scene " << ply << ": " << numTris << " triangles, "
+                  << width << "x" << height << ", " << numShadows
+                  << " shadow rays, " << ThreadPool::instance().size()
+                  << " threads, " << repeat << " runs\n";
+        std::cout << "  " << std::left << std::setw(18) << "" << std::right
+                  << std::setw(11) << "median" << std::setw(11) << "min"
+                  << std::setw(11) << "max" << std::setw(10) << "spread"
+                  << "\n";
+        summary("build ms", build);
+        summary("primary Mrays/s", primary);
+        summary("shadow Mrays/s", shadow);
+        summary("render ms", render);
+        std::cout << "  " << std::left << std::setw(18) << "peak RSS MB"
+                  << std::right << std::setprecision(1) << std::setw(11)
+                  << StatsReport::peakRSS() / 1048576.0 << "\n";
+
+        ThreadPool::instance().stop();
+        return 0;
+}
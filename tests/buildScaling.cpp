@@ -0,0 +1,211 @@
+//
+// Measures how the kd-tree build grows with the size of the mesh, run by
+// `make bench-build` on generated meshes of 1K to 10M triangles. Every mesh
+// is built in its own process, so the peak memory of one build does not
+// hide the next.
+//
+// Usage: buildScaling scene.ply [more.ply ...] [options]
+//
+//   --threads N         ThreadPool size (default 0, all cores)
+//   --binned N          build the kd-tree with N bins (default exact SAH)
+//   --perfect           clip straddling triangles when splitting
+//   --max-exponent E    fail if a measure grows faster than N^E between two
+//                       consecutive meshes (default 1.3)
+//   --csv file          also write the measures to file, one mesh per line
+//
+// For each mesh, prints the build time, node count, events swept by the
+// build and peak resident memory, then the growth exponent of each measure
+// since the previous (smaller) mesh: log(y2 / y1) / log(N2 / N1). An
+// O(N log N) build stays slightly above 1. Builds shorter than 50 ms are
+// too noisy to bound their time exponent.
+//
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "KDTree2.h"
+#include "Log.h"
+#include "PolyObject.h"
+#include "StatsReport.h"
+#include "ThreadPool.h"
+
+using namespace RayTracerxx;
+
+struct Sample {
+        size_t triangles;
+        double seconds;
+        size_t nodes;
+        size_t events;
+        double loadMB;  // peak RSS once the mesh is loaded
+        double peakMB;  // peak RSS after the build
+};
+
+constexpr double minSeconds = 0.05;
+
+double peakMB() { return StatsReport::peakRSS() / 1048576.0; }
+
+/**
+ * @brief      Loads and builds one mesh in a child process
+ *
+ * @param[out] sample  The measures
+ *
+ * @return     Whether the child succeeded
+ */
+bool measure(const std::string& ply, unsigned threads,
+             const KDTree::BuildOptions& opts, Sample& sample) {
+        int fds[2];
+        if (pipe(fds) != 0)
+                return false;
+
+        pid_t pid = fork();
+        if (pid < 0)
+                return false;
+        if (pid == 0) {
+                close(fds[0]);
+                Log::setVerbosity(Log::QUIET);
+                ThreadPool::instance().start(threads);
+
+                PolyObject              object(ply);
+                std::vector<Triangle*> tris;
+                for (Triangle& tri : object.mesh)
+                        tris.push_back(&tri);
+                Sample s    = Sample();
+                s.triangles = tris.size();
+                s.loadMB    = peakMB();
+
+                auto   start = std::chrono::steady_clock::now();
+                KDTree tree(object.bbox, tris, opts);
+                s.seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+                s.peakMB = peakMB();
+
+                KDTree::Report r = tree.report();
+                s.nodes          = r.numInner + r.numLeaves;
+                s.events         = r.buildEvents;
+                ssize_t written  = write(fds[1], &s, sizeof(s));
+                _exit(written == sizeof(s) and s.triangles > 0 ? 0 : 1);
+        }
+
+        close(fds[1]);
+        ssize_t got = read(fds[0], &sample, sizeof(sample));
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return got == sizeof(sample) and WIFEXITED(status) and
+               WEXITSTATUS(status) == 0;
+}
+
+double exponent(double y1, double y2, double n1, double n2) {
+        if (y1 <= 0 or y2 <= 0)
+                return 0;
+        return std::log(y2 / y1) / std::log(n2 / n1);
+}
+
+int main(int argc, char* argv[]) {
+        std::vector<std::string> plys;
+        std::string              csv;
+        unsigned                 threads     = 0;
+        double                   maxExponent = 1.3;
+        KDTree::BuildOptions     opts;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--threads" and i + 1 < argc)
+                        threads = std::atoi(argv[++i]);
+                else if (arg == "--binned" and i + 1 < argc)
+                        opts.bins = std::atoi(argv[++i]);
+                else if (arg == "--perfect")
+                        opts.perfectSplits = true;
+                else if (arg == "--max-exponent" and i + 1 < argc)
+                        maxExponent = std::atof(argv[++i]);
+                else if (arg == "--csv" and i + 1 < argc)
+                        csv = argv[++i];
+                else
+                        plys.push_back(arg);
+        }
+        if (plys.empty()) {
+                std::cerr << "Usage: buildScaling scene.ply [more.ply ...] "
+                             "[--threads N] [--binned N] [--perfect] "
+                             "[--max-exponent E] [--csv file]\n";
+                return 2;
+        }
+
+        std::vector<Sample> samples;
+        for (const std::string& ply : plys) {
+                Sample s;
+                if (not measure(ply, threads, opts, s)) {
+                        std::cerr << "Unable to build " << ply << "\n";
+                        return 2;
+                }
+                samples.push_back(s);
+        }
+        std::sort(samples.begin(), samples.end(),
+                  [](const Sample& a, const Sample& b) {
+                          return a.triangles < b.triangles;
+                  });
+
+        std::cout << std::setw(10) << "triangles" << std::setw(10) << "build s"
+                  << std::setw(10) << "nodes" << std::setw(12) << "events"
+                  << std::setw(10) << "peak MB" << std::setw(13)
+                  << "exponents:";
+        for (const char* name : {"time", "nodes", "events", "memory"})
+                std::cout << std::setw(6) << name << " ";
+        std::cout << "\n";
+
+        unsigned failures = 0;
+        for (size_t i = 0; i < samples.size(); i++) {
+                const Sample& s = samples[i];
+                std::cout << std::setw(10) << s.triangles << std::fixed
+                          << std::setprecision(3) << std::setw(10)
+                          << s.seconds << std::setw(10) << s.nodes
+                          << std::setw(12) << s.events << std::setprecision(1)
+                          << std::setw(10) << s.peakMB;
+                if (i == 0 or samples[i - 1].triangles == s.triangles) {
+                        std::cout << "\n";
+                        continue;
+                }
+
+                const Sample& p = samples[i - 1];
+                double        n1 = p.triangles, n2 = s.triangles;
+                double        e[4] = {exponent(p.seconds, s.seconds, n1, n2),
+                               exponent(p.nodes, s.nodes, n1, n2),
+                               exponent(p.events, s.events, n1, n2),
+                               exponent(p.peakMB, s.peakMB, n1, n2)};
+                bool          timed = p.seconds >= minSeconds;
+
+                std::cout << std::string(13, ' ') << std::setprecision(2);
+                for (int k = 0; k < 4; k++) {
+                        bool over = e[k] > maxExponent and (k > 0 or timed);
+                        failures += over;
+                        std::cout << std::setw(6) << e[k] << (over ? "!" : " ");
+                }
+                std::cout << "\n";
+        }
+
+        if (not csv.empty()) {
+                std::ofstream out(csv.c_str());
+                out << "triangles,build_seconds,nodes,events,load_mb,peak_mb\n";
+                for (const Sample& s : samples)
+                        out << s.triangles << "," << s.seconds << ","
+                            << s.nodes << "," << s.events << "," << s.loadMB
+                            << "," << s.peakMB << "\n";
+                if (not out)
+                        std::cerr << "Unable to write " << csv << "\n";
+        }
+
+        if (failures > 0) {
+                std::cout << failures
+                          << " measures grew faster than N^" << maxExponent
+                          << " (marked !)\n";
+                return 1;
+        }
+        return 0;
+}
@@ -1,4 +1,12 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "BenchLights.h"
 
 using namespace std;
 
@@ -15,17 +23,331 @@ string translate();
 string preview();
 string setPosition(double x, double y, double z);
 
-// TODO: Detect Malformed Primitives (i.e not triangles)
-int main() {
-
-        cout << newScene(1920 * 3, 1080 * 3)
-             << newObject("./assets/cow.ply")
-             << setPosition(-0.375,1.625,3.5)
-             << newLight(1.000000,0.000000,0.000000,2147483647,0,0)
-             << newLight(1.000000,1.000000,0.000000,2147483647,0,0)
-             << newLight(0.000000,1.000000,0.000000,0,2147483647,0)
-             << render("cow.ppm")
-             << preview();
+//
+// Writes a binary little endian PLY file. Generators emit every vertex
+// before any face, as the format requires. A writer that was not opened
+// only counts, so a generator is run once to size the header and once to
+// write the file.
+//
+class PlyWriter {
+public:
+        PlyWriter() : numVertices(0), numFaces(0), counting(true) {}
+
+        bool open(const string& filename) {
+                out.open(filename.c_str(), ios::binary);
+                if (not out.is_open())
+                        return false;
+
+                out << "ply\n"
+                    << "format binary_little_endian 1.0\n"
+                    << "comment generated by generateScene\n"
+                    << "element vertex " << numVertices << "\n"
+                    << "property float x\n"
+                    << "property float y\n"
+                    << "property float z\n"
+                    << "element face " << numFaces << "\n"
+                    << "property list uchar uint vertex_indices\n"
+                    << "end_header\n";
+                counting = false;
+                return true;
+        }
+
+        void vertex(double x, double y, double z) {
+                if (counting) {
+                        numVertices++;
+                        return;
+                }
+                float v[3] = {float(x), float(y), float(z)};
+                append(v, sizeof(v));
+        }
+
+        void face(uint64_t a, uint64_t b, uint64_t c) {
+                if (counting) {
+                        numFaces++;
+                        return;
+                }
+                uint8_t  n    = 3;
+                uint32_t v[3] = {uint32_t(a), uint32_t(b), uint32_t(c)};
+                append(&n, 1);
+                append(v, sizeof(v));
+        }
+
+        // closes the file, returns whether everything was written
+        bool close() {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+                out.close();
+                return not out.fail();
+        }
+
+        uint64_t numVertices, numFaces;
+
+private:
+        void append(const void* data, size_t bytes) {
+                const char* p = static_cast<const char*>(data);
+                buffer.insert(buffer.end(), p, p + bytes);
+                if (buffer.size() >= (1 << 20)) {
+                        out.write(buffer.data(), buffer.size());
+                        buffer.clear();
+                }
+        }
+
+        bool         counting;
+        ofstream     out;
+        vector<char> buffer;
+};
+
+//
+// Uniform doubles from mt19937_64, whose sequence the standard fixes, so
+// a seed gives the same mesh with every compiler
+//
+class Random {
+public:
+        explicit Random(uint64_t seed) : engine(seed) {}
+
+        double uniform(double lo, double hi) {
+                return lo + (hi - lo) * ((engine() >> 11) / 9007199254740992.0);
+        }
+
+private:
+        mt19937_64 engine;
+};
+
+// Corners of the 6 faces of a box whose vertex i is at x = i & 1, y = i & 2,
+// z = i & 4
+const int boxQuads[6][4] = {{0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4},
+                            {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}};
+
+// Emits the (n + 1)^2 vertices of face (a, sign) of a cube sphere
+void cubeFace(PlyWriter& w, int a, int sign, uint64_t n, const double c[3],
+              double r) {
+        for (uint64_t i = 0; i <= n; i++) {
+                for (uint64_t j = 0; j <= n; j++) {
+                        double p[3];
+                        p[a]           = sign;
+                        p[(a + 1) % 3] = -1.0 + 2.0 * i / n;
+                        p[(a + 2) % 3] = -1.0 + 2.0 * j / n;
+                        double s =
+                            r / sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+                        w.vertex(c[0] + s * p[0], c[1] + s * p[1],
+                                 c[2] + s * p[2]);
+                }
+        }
+}
+
+//
+// A grid of cube spheres: every face of a cube is subdivided into n x n
+// quads, whose corners are projected onto the sphere. Large counts are
+// spread over up to 64 spheres. Faces wind outwards.
+//
+double spheres(PlyWriter& w, uint64_t triangles, Random& random) {
+        uint64_t numSpheres =
+            min<uint64_t>(64, max<uint64_t>(1, triangles / 50000));
+        uint64_t n = max<uint64_t>(
+            1, llround(sqrt(double(triangles) / (12 * numSpheres))));
+        uint64_t grid = uint64_t(ceil(cbrt(double(numSpheres))));
+
+        for (uint64_t s = 0; s < numSpheres; s++) {
+                double center[3] = {3.0 * (s % grid) - 1.5 * (grid - 1),
+                                    3.0 * (s / grid % grid) - 1.5 * (grid - 1),
+                                    -3.0 * double(s / grid / grid)};
+                double radius    = random.uniform(0.8, 1.2);
+                for (int a = 0; a < 3; a++)
+                        for (int sign = -1; sign <= 1; sign += 2)
+                                cubeFace(w, a, sign, n, center, radius);
+        }
+
+        for (uint64_t base = 0; base < 6 * numSpheres * (n + 1) * (n + 1);
+             base += (n + 1) * (n + 1)) {
+                bool outwards = base / ((n + 1) * (n + 1)) % 2 == 1;
+                for (uint64_t i = 0; i < n; i++) {
+                        for (uint64_t j = 0; j < n; j++) {
+                                uint64_t v00 = base + i * (n + 1) + j;
+                                uint64_t v10 = v00 + n + 1;
+                                if (outwards) {
+                                        w.face(v00, v10, v10 + 1);
+                                        w.face(v00, v10 + 1, v00 + 1);
+                                } else {
+                                        w.face(v00, v10 + 1, v10);
+                                        w.face(v00, v00 + 1, v10 + 1);
+                                }
+                        }
+                }
+        }
+        return 1.5 * grid;
+}
+
+//
+// Independent random triangles in a cube of side 20, sized so that their
+// number per unit volume is roughly constant
+//
+double soup(PlyWriter& w, uint64_t triangles, Random& random) {
+        double size = 30.0 / cbrt(double(triangles));
+
+        for (uint64_t t = 0; t < triangles; t++) {
+                double c[3];
+                for (double& x : c)
+                        x = random.uniform(-10, 10);
+                for (int v = 0; v < 3; v++)
+                        w.vertex(c[0] + random.uniform(-size, size),
+                                 c[1] + random.uniform(-size, size),
+                                 c[2] + random.uniform(-size, size));
+        }
+        for (uint64_t t = 0; t < triangles; t++)
+                w.face(3 * t, 3 * t + 1, 3 * t + 2);
+        return 10;
+}
+
+//
+// A 100 x 100 ground plane holding half of the triangles, cluttered with
+// boxes of every size. Leftover triangles are small slivers on the ground.
+//
+double ground(PlyWriter& w, uint64_t triangles, Random& random) {
+        uint64_t m        = max<uint64_t>(1, uint64_t(sqrt(triangles / 4.0)));
+        uint64_t numBoxes = (triangles - min(triangles, 2 * m * m)) / 12;
+        uint64_t numSlivers =
+            triangles - min(triangles, 2 * m * m + 12 * numBoxes);
+
+        for (uint64_t i = 0; i <= m; i++)
+                for (uint64_t j = 0; j <= m; j++)
+                        w.vertex(-50.0 + 100.0 * i / m, 0,
+                                 -50.0 + 100.0 * j / m);
+
+        vector<double> boxes(6 * numBoxes);
+        for (uint64_t b = 0; b < numBoxes; b++) {
+                double  size = exp(random.uniform(log(0.05), log(5.0)));
+                double* lo   = &boxes[6 * b];
+                double* hi   = lo + 3;
+                lo[0]        = random.uniform(-50, 50 - size);
+                lo[1]        = 0;
+                lo[2]        = random.uniform(-50, 50 - size);
+                hi[0]        = lo[0] + size * random.uniform(0.3, 1);
+                hi[1]        = size * random.uniform(0.3, 2);
+                hi[2]        = lo[2] + size * random.uniform(0.3, 1);
+                for (int i = 0; i < 8; i++)
+                        w.vertex(i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1],
+                                 i & 4 ? hi[2] : lo[2]);
+        }
+        for (uint64_t s = 0; s < numSlivers; s++) {
+                double x = random.uniform(-50, 50), z = random.uniform(-50, 50);
+                w.vertex(x, 0.01, z);
+                w.vertex(x + 0.2, 0.01, z);
+                w.vertex(x, 0.01, z + 0.02);
+        }
+
+        for (uint64_t i = 0; i < m; i++) {
+                for (uint64_t j = 0; j < m; j++) {
+                        uint64_t v00 = i * (m + 1) + j;
+                        w.face(v00, v00 + 1, v00 + m + 2);
+                        w.face(v00, v00 + m + 2, v00 + m + 1);
+                }
+        }
+        uint64_t next = (m + 1) * (m + 1);
+        for (uint64_t b = 0; b < numBoxes; b++, next += 8) {
+                for (const int* q : boxQuads) {
+                        w.face(next + q[0], next + q[1], next + q[2]);
+                        w.face(next + q[0], next + q[2], next + q[3]);
+                }
+        }
+        for (uint64_t s = 0; s < numSlivers; s++, next += 3)
+                w.face(next, next + 1, next + 2);
+        return 50;
+}
+
+//
+// Long thin triangles (5 long, 0.02 wide) in a cube of side 20, in random
+// directions. Every one straddles many kd-tree cells, the worst case for
+// the build and for traversal.
+//
+double thin(PlyWriter& w, uint64_t triangles, Random& random) {
+        for (uint64_t t = 0; t < triangles; t++) {
+                double c[3], d[3], len = 0;
+                for (int k = 0; k < 3; k++) {
+                        c[k] = random.uniform(-10, 10);
+                        d[k] = random.uniform(-1, 1);
+                        len += d[k] * d[k];
+                }
+                len = sqrt(len) / 2.5;  // half length 2.5
+                w.vertex(c[0] - d[0] / len, c[1] - d[1] / len,
+                         c[2] - d[2] / len);
+                w.vertex(c[0] + d[0] / len, c[1] + d[1] / len,
+                         c[2] + d[2] / len);
+                w.vertex(c[0] + random.uniform(-0.01, 0.01),
+                         c[1] + random.uniform(-0.01, 0.01),
+                         c[2] + random.uniform(-0.01, 0.01));
+        }
+        for (uint64_t t = 0; t < triangles; t++)
+                w.face(3 * t, 3 * t + 1, 3 * t + 2);
+        return 10;
+}
+
+// Parses counts like 5000, 10K or 50M
+uint64_t parseCount(const string& text) {
+        char*    end;
+        double   value = strtod(text.c_str(), &end);
+        string   unit(end);
+        uint64_t scale = unit == "K" or unit == "k" ? 1000
+                         : unit == "M" or unit == "m" ? 1000000 : 1;
+        return unit.empty() or scale > 1 ? uint64_t(value * scale) : 0;
+}
+
+//
+// Writes a procedural mesh and prints a scene script that renders it:
+//
+//   generateScene kind triangles out.ply [seed] | ./RayTracer++
+//
+// where kind is spheres, soup, ground or thin.
+// Meshes from 1K to 50M triangles are meant for the benchmarks; the same
+// arguments always give the same file.
+//
+int main(int argc, char* argv[]) {
+        typedef double (*Generator)(PlyWriter&, uint64_t, Random&);
+        const string    kinds[]      = {"spheres", "soup", "ground", "thin"};
+        const Generator generators[] = {spheres, soup, ground, thin};
+
+        int kind = -1;
+        for (int k = 0; argc > 1 and k < 4; k++)
+                if (kinds[k] == argv[1])
+                        kind = k;
+        uint64_t triangles = argc > 2 ? parseCount(argv[2]) : 0;
+        if (argc < 4 or kind < 0 or triangles == 0) {
+                cerr << "Usage: generateScene spheres|soup|ground|thin "
+                        "triangles out.ply [seed]\n"
+                        "       triangles may use K or M, e.g. 1K to 50M\n";
+                return 2;
+        }
+        string   path = argv[3];
+        uint64_t seed = argc > 4 ? strtoull(argv[4], NULL, 10) : 1;
+
+        PlyWriter writer;
+        Random    sizing(seed);
+        generators[kind](writer, triangles, sizing);
+        if (writer.numVertices >= (uint64_t(1) << 32) / 3) {
+                cerr << "Too many vertices for 32 bit indices\n";
+                return 1;
+        }
+        if (not writer.open(path)) {
+                cerr << "Unable to open " << path << "\n";
+                return 1;
+        }
+        Random random(seed);
+        double extent = generators[kind](writer, triangles, random);
+        if (not writer.close()) {
+                cerr << "Unable to write " << path << "\n";
+                return 1;
+        }
+        cerr << "Wrote " << writer.numFaces << " triangles, "
+             << writer.numVertices << " vertices to " << path << "\n";
+
+        string image = path.substr(0, path.rfind('.')) + ".ppm";
+        cout << newScene(1280, 720)
+             << newObject(path)
+             << setPosition(0, kind == 2 ? 10 : 0, 1.5 * extent + 3);
+        for (const RayTracerxx::BenchLight& light : RayTracerxx::benchLights)
+                cout << newLight(light.color[0], light.color[1],
+                                 light.color[2], light.position[0],
+                                 light.position[1], light.position[2]);
+        cout << render(image);
 }
 
 string newScene(unsigned width, unsigned height){
@@ -65,4 +387,4 @@ string setPosition(double x, double y, double z){
         return string(__func__) + " "  + to_string(x) + " "
                                        + to_string(y) + " "
                                        + to_string(z) + "\n";
-}
\ No newline at end of file
+}
@@ -0,0 +1,79 @@
+//
+// Compares a render with a reference image, run by `make check-images` on
+// the golden renders of tests/golden.
+//
+// Usage: imageDiff expected.ppm actual.ppm [options]
+//
+//   --min-psnr dB      fail below this PSNR (default 40)
+//   --max-error N      fail if a channel is off by more than N levels of
+//                      0 to 255 (default 16)
+//   --diff out.ppm     write a heatmap of the differences: black where
+//                      equal, red from --heat-max levels (default 16)
+//
+// Both images may be P3 or P6. Exits with 1 if the images differ beyond
+// the thresholds or in size, 2 if one can not be read.
+//
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "ImageEngine.h"
+
+using namespace RayTracerxx;
+
+int main(int argc, char* argv[]) {
+        std::string files[2], diffFile;
+        int         numFiles = 0;
+        double      minPsnr = 40, maxError = 16;
+        int         heatMax = 16;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--min-psnr" and i + 1 < argc)
+                        minPsnr = std::atof(argv[++i]);
+                else if (arg == "--max-error" and i + 1 < argc)
+                        maxError = std::atof(argv[++i]);
+                else if (arg == "--diff" and i + 1 < argc)
+                        diffFile = argv[++i];
+                else if (arg == "--heat-max" and i + 1 < argc)
+                        heatMax = std::max(1, std::atoi(argv[++i]));
+                else if (numFiles < 2)
+                        files[numFiles++] = arg;
+                else
+                        numFiles = 3;
+        }
+        if (numFiles != 2) {
+                std::cerr << "Usage: imageDiff expected.ppm actual.ppm "
+                             "[--min-psnr dB] [--max-error N] "
+                             "[--diff out.ppm] [--heat-max N]\n";
+                return 2;
+        }
+
+        ImageEngine expected, actual, diff;
+        if (not expected.readImage(files[0]) or not actual.readImage(files[1]))
+                return 2;
+
+        ImageDiff result;
+        if (not expected.compare(actual, result,
+                                 diffFile.empty() ? NULL : &diff, heatMax)) {
+                const Image &a = expected.getImage(), &b = actual.getImage();
+                std::cout << files[1] << ": " << b.width << "x" << b.height
+                          << ", expected " << a.width << "x" << a.height
+                          << "\n";
+                return 1;
+        }
+        if (not diffFile.empty())
+                diff.save(diffFile);
+
+        bool ok = result.psnr >= minPsnr and result.maxError <= maxError;
+        std::cout << files[1] << ": PSNR " << std::fixed
+                  << std::setprecision(2) << result.psnr << " dB, max error "
+                  << result.maxError;
+        if (result.maxError > 0)
+                std::cout << " at (" << result.maxX << ", " << result.maxY
+                          << ")";
+        std::cout << ", " << result.differentPixels << " pixels differ"
+                  << (ok ? "" : "  FAILED") << "\n";
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+//
+// Fires random and camera rays at procedural meshes and checks every answer
+// of the kd-tree against the brute-force loop over all triangles (see
+// KDTreeOracle.h), then reports how much faster the tree was.
+//
+// Usage: kdtreeOracle [options]
+//
+//   --rays N          random rays per mesh, K and M suffixes allowed
+//                     (default 1M)
+//   --camera WxH      camera rays per mesh (default 1280x720)
+//   --triangles N     triangles per mesh (default 2K)
+//   --mesh kind       spheres, soup, grid or all (default all)
+//   --seed N          seed of meshes and rays (default 1)
+//   --threads N       ThreadPool size (default 0, all cores)
+//   --binned N        build the kd-tree with N bins (default exact SAH)
+//   --perfect         clip straddling triangles when splitting
+//   --tolerance T     relative tolerance on t (default 1e-9)
+//
+// Brute force costs rays x triangles intersection tests, so keep the meshes
+// small. Exits with 1 if any ray disagrees.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "KDTree2.h"
+#include "KDTreeOracle.h"
+#include "Log.h"
+#include "ThreadPool.h"
+
+using namespace RayTracerxx;
+
+// Parses counts like 5000, 10K or 50M
+size_t parseCount(const std::string& text) {
+        char*       end;
+        double      value = std::strtod(text.c_str(), &end);
+        std::string unit(end);
+        size_t      scale = unit == "K" or unit == "k"   ? 1000
+                            : unit == "M" or unit == "m" ? 1000000 : 1;
+        return unit.empty() or scale > 1 ? size_t(value * scale) : 0;
+}
+
+void report(const std::string& mesh, size_t numTris, const std::string& kind,
+            const OracleResult& r) {
+        std::cout << std::left << std::setw(8) << mesh << std::right
+                  << std::setw(8) << numTris << " triangles  " << std::left
+                  << std::setw(7) << kind << std::right << std::setw(9)
+                  << r.rays << " rays " << std::fixed << std::setprecision(1)
+                  << std::setw(5) << 100.0 * r.hits / r.rays << "% hits  "
+                  << std::setprecision(3) << "kd-tree " << std::setw(7)
+                  << r.treeSeconds << " s  brute " << std::setw(8)
+                  << r.bruteSeconds << " s  speedup " << std::setprecision(0)
+                  << std::setw(5) << r.speedup() << "x  " << r.ties
+                  << " ties  " << r.mismatches << " mismatches\n";
+}
+
+int main(int argc, char* argv[]) {
+        size_t               numRays = 1000000, numTris = 2000;
+        unsigned             width = 1280, height = 720, seed = 1, threads = 0;
+        std::string          kind = "all";
+        Number_t             tolerance = 1e-9;
+        KDTree::BuildOptions opts;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg  = argv[i];
+                bool        more = i + 1 < argc;
+                if (arg == "--rays" and more)
+                        numRays = parseCount(argv[++i]);
+                else if (arg == "--camera" and more)
+                        std::sscanf(argv[++i], "%ux%u", &width, &height);
+                else if (arg == "--triangles" and more)
+                        numTris = parseCount(argv[++i]);
+                else if (arg == "--mesh" and more)
+                        kind = argv[++i];
+                else if (arg == "--seed" and more)
+                        seed = std::atoi(argv[++i]);
+                else if (arg == "--threads" and more)
+                        threads = std::atoi(argv[++i]);
+                else if (arg == "--binned" and more)
+                        opts.bins = std::atoi(argv[++i]);
+                else if (arg == "--perfect")
+                        opts.perfectSplits = true;
+                else if (arg == "--tolerance" and more)
+                        tolerance = std::atof(argv[++i]);
+                else {
+                        numTris = 0;
+                        break;
+                }
+        }
+        if (numTris == 0 or (kind != "all" and kind != "spheres" and
+                             kind != "soup" and kind != "grid")) {
+                std::cerr << "Usage: kdtreeOracle [--rays N] [--camera WxH] "
+                             "[--triangles N] [--mesh spheres|soup|grid|all] "
+                             "[--seed N] [--threads N] [--binned N] "
+                             "[--perfect] [--tolerance T]\n";
+                return 2;
+        }
+
+        ThreadPool::instance().start(threads);
+        Log::setVerbosity(Log::QUIET);
+
+        size_t mismatches = 0;
+        for (const char* name : {"spheres", "soup", "grid"}) {
+                if (kind != "all" and kind != name)
+                        continue;
+
+                OracleMesh mesh;
+                if (std::string(name) == "spheres")
+                        mesh = oracleSpheres(numTris, seed);
+                else if (std::string(name) == "soup")
+                        mesh = oracleSoup(numTris, seed);
+                else
+                        mesh = oracleGrid(numTris);
+                std::vector<Triangle*> tris = mesh.pointers();
+
+                KDTree tree(mesh.bbox, tris, opts);
+
+                std::vector<Ray> random =
+                    oracleRandomRays(mesh.bbox, numRays, seed);
+                OracleResult r =
+                    oracleCheck(tree, tris, random, tolerance, std::cerr);
+                report(name, tris.size(), "random", r);
+                mismatches += r.mismatches;
+
+                if (width > 0 and height > 0) {
+                        std::vector<Ray> camera =
+                            oracleCameraRays(mesh.bbox, width, height);
+                        r = oracleCheck(tree, tris, camera, tolerance,
+                                        std::cerr);
+                        report(name, tris.size(), "camera", r);
+                        mismatches += r.mismatches;
+                }
+        }
+
+        ThreadPool::instance().stop();
+        return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+//
+// Microbenchmarks of the innermost kernels of traversal: Box::Intersect,
+// Triangle::Intersect and the Vector<3> operations they are built from.
+// Triangle::Intersect is also timed on its precomputed TriAccel record, as
+// KDTree traversal runs it.
+// Every kernel is paired with a baseline on raw double[3] arrays running the
+// same arithmetic, so the difference is the cost of the OrderedList
+// abstraction (copies, operator overloads, assertInRange on operator[]).
+//
+// Usage: microbench [--min-time seconds]
+//
+// Box and triangle kernels run over three ray distributions: rays that hit,
+// rays that miss, and rays parallel to a slab or to the triangle plane.
+// Inputs are small arrays (they stay in cache), so the numbers are the
+// arithmetic cost alone. Each kernel reports the best of 5 runs in ns per
+// call and millions of calls per second, and the fraction of hits as a
+// check that both versions computed the same thing.
+//
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Box.h"
+#include "OrderedList.h"
+#include "PolyObject.h"
+#include "ray.h"
+
+using namespace RayTracerxx;
+
+namespace {
+
+constexpr size_t numInputs = 4096;  // of each kind, fits in L2
+
+double minTime = 0.2;  // seconds per run
+
+// Keeps the compiler from discarding a result
+template <class T>
+inline void keep(const T& value) {
+#if defined(__GNUC__)
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+}
+
+/**
+ * @brief      Runs kernel(i) for i = 0, 1, ... over the inputs until minTime
+ *             has passed, 5 times, and prints the best run
+ *
+ * @param[in]  name    The name
+ * @param[in]  kernel  Returns whether input i was a hit
+ */
+template <class Kernel>
+void run(const std::string& name, Kernel kernel) {
+        using namespace std::chrono;
+        double best = 1e30;
+        size_t hits = 0;
+
+        for (int r = 0; r < 5; r++) {
+                size_t calls = 0;
+                hits         = 0;
+                auto   start = steady_clock::now();
+                double elapsed;
+                do {
+                        for (size_t i = 0; i < numInputs; i++)
+                                hits += kernel(i);
+                        calls += numInputs;
+                        elapsed =
+                            duration<double>(steady_clock::now() - start)
+                                .count();
+                } while (elapsed < minTime);
+                best  = std::min(best, elapsed / calls);
+                hits  = hits * numInputs / calls;
+        }
+
+        std::cout << "  " << std::left << std::setw(34) << name << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(10)
+                  << best * 1e9 << std::setw(12) << 1e-6 / best
+                  << std::setprecision(1) << std::setw(8)
+                  << 100.0 * hits / numInputs << "%\n";
+}
+
+/*
+ *                      Raw double[3] baselines
+ */
+
+inline double rawDot(const double a[3], const double b[3]) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline void rawCross(const double a[3], const double b[3], double out[3]) {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline void rawNormalize(double v[3]) {
+        double m = std::sqrt(rawDot(v, v));
+        if (m != 0)
+                for (int k = 0; k < 3; k++)
+                        v[k] /= m;
+}
+
+struct RawRay {
+        double origin[3], direction[3], t;
+        bool   isNeg[3];
+};
+
+inline double rawInv(const RawRay& r, int k) {
+        return r.direction[k] == 0 ? Ray::Infinity : 1 / r.direction[k];
+}
+
+// Box::Intersect on raw arrays
+inline bool rawBox(const double low[3], const double hi[3], const RawRay& r) {
+        double tmin  = ((r.isNeg[0] ? hi : low)[0] - r.origin[0]) * rawInv(r, 0);
+        double tmax  = ((r.isNeg[0] ? low : hi)[0] - r.origin[0]) * rawInv(r, 0);
+        double tymin = ((r.isNeg[1] ? hi : low)[1] - r.origin[1]) * rawInv(r, 1);
+        double tymax = ((r.isNeg[1] ? low : hi)[1] - r.origin[1]) * rawInv(r, 1);
+        if (tymin > tymax or tmin > tmax)
+                return false;
+        tmin = std::max(tmin, tymin);
+        tmax = std::min(tmax, tymax);
+
+        double tzmin = ((r.isNeg[2] ? hi : low)[2] - r.origin[2]) * rawInv(r, 2);
+        double tzmax = ((r.isNeg[2] ? low : hi)[2] - r.origin[2]) * rawInv(r, 2);
+        if (tzmin > tzmax or tmin > tmax)
+                return false;
+        tmin = std::max(tmin, tzmin);
+        tmax = std::min(tmax, tzmax);
+        return tmax >= 0 and tmin <= tmax;
+}
+
+// Triangle::Intersect (Möller–Trumbore) on raw arrays
+inline bool rawTriangle(const double v[3][3], RawRay& r) {
+        const double EPSILON = 0.0000001;
+        double       edge1[3], edge2[3], h[3], s[3], q[3];
+        for (int k = 0; k < 3; k++) {
+                edge1[k] = v[1][k] - v[0][k];
+                edge2[k] = v[2][k] - v[0][k];
+                s[k]     = r.origin[k] - v[0][k];
+        }
+        rawCross(r.direction, edge2, h);
+        double a = rawDot(edge1, h);
+        if (a > -EPSILON and a < EPSILON)
+                return false;
+        double f = 1.0 / a;
+        double u = f * rawDot(s, h);
+        if (u < 0.0 or u > 1.0)
+                return false;
+        rawCross(s, edge1, q);
+        double w = f * rawDot(r.direction, q);
+        if (w < 0.0 or u + w > 1.0)
+                return false;
+        double t = f * rawDot(edge2, q);
+        if (t <= EPSILON or t >= r.t)
+                return false;
+        r.t = t;
+        return true;
+}
+
+RawRay toRaw(const Ray& ray) {
+        RawRay r;
+        for (int k = 0; k < 3; k++) {
+                r.origin[k]    = ray.origin[k];
+                r.direction[k] = ray.direction[k];
+                r.isNeg[k]     = ray.isNeg[k];
+        }
+        r.t = ray.t;
+        return r;
+}
+
+/*
+ *                          Input distributions
+ */
+
+struct Inputs {
+        std::vector<Ray>    rays;
+        std::vector<RawRay> raw;
+
+        void add(const Vector<3>& origin, Vector<3> direction) {
+                direction.normalize();
+                rays.push_back(Ray(Point<3>(origin), direction));
+                raw.push_back(toRaw(rays.back()));
+        }
+};
+
+// Unit box centered at the origin; rays start on a sphere of radius 5
+Inputs boxRays(const std::string& kind, std::mt19937_64& rng) {
+        std::uniform_real_distribution<double> u(-1, 1);
+        Inputs                                 in;
+        while (in.rays.size() < numInputs) {
+                Vector<3> o{u(rng), u(rng), u(rng)};
+                if (o.norm() == 0)
+                        continue;
+                o.normalize();
+                o = o * 5.0;
+                Vector<3> target{0.4 * u(rng), 0.4 * u(rng), 0.4 * u(rng)};
+                if (kind == "hit")
+                        in.add(o, target - o);
+                else if (kind == "miss")  // past a corner, a few clip it
+                        in.add(o, (target + Vector<3>{2.5, 2.5, 0}) - o);
+                else {  // along an axis, from around the box
+                        Vector<3> d{0, 0, 0};
+                        d[rng() % 3] = u(rng) < 0 ? -1 : 1;
+                        in.add(Vector<3>{u(rng), u(rng), u(rng)} * 1.0, d);
+                }
+        }
+        return in;
+}
+
+// Triangle (0,0,0) (1,0,0) (0,1,0); rays start above it at z = 2
+Inputs triangleRays(const std::string& kind, std::mt19937_64& rng) {
+        std::uniform_real_distribution<double> u(0, 1);
+        Inputs                                 in;
+        while (in.rays.size() < numInputs) {
+                Vector<3> o{u(rng) * 4 - 2, u(rng) * 4 - 2, 2};
+                double    a = u(rng), b = u(rng);
+                if (kind == "hit") {
+                        if (a + b > 1)
+                                a = 1 - a, b = 1 - b;
+                        in.add(o, Vector<3>{a, b, 0} - o);
+                } else if (kind == "miss") {  // past the hypotenuse
+                        in.add(o, Vector<3>{0.6 + a, 0.6 + b, 0} - o);
+                } else {  // in a plane parallel to the triangle
+                        in.add(o, Vector<3>{a - 0.5, b - 0.5, 0});
+                }
+        }
+        return in;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+        for (int i = 1; i < argc; i++)
+                if (std::string(argv[i]) == "--min-time" and i + 1 < argc)
+                        minTime = std::atof(argv[++i]);
+
+        std::mt19937_64 rng(1);
+        std::cout << "  " << std::left << std::setw(34) << "kernel"
+                  << std::right << std::setw(10) << "ns/call" << std::setw(12)
+                  << "Mcalls/s" << std::setw(9) << "hits"
+                  << "\n";
+
+        // Box::Intersect
+        const Box box(0.5, 0.5, 0.5, -0.5, -0.5, -0.5);
+        for (const char* kind : {"hit", "miss", "parallel"}) {
+                Inputs in = boxRays(kind, rng);
+                run(std::string("Box::Intersect ") + kind, [&](size_t i) {
+                        std::pair<Number_t, Number_t> t =
+                            box.Intersect(in.rays[i]);
+                        return t.first != Ray::Infinity;
+                });
+                run(std::string("  raw double[3] ") + kind, [&](size_t i) {
+                        return rawBox(box.low, box.hi, in.raw[i]);
+                });
+        }
+
+        // Triangle::Intersect
+        Triangle tri(Point<3>{0, 0, 0}, Point<3>{1, 0, 0}, Point<3>{0, 1, 0});
+        TriAccel acc     = tri.accel();
+        double   v[3][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}};
+        for (const char* kind : {"hit", "miss", "parallel"}) {
+                Inputs in = triangleRays(kind, rng);
+                run(std::string("Triangle::Intersect ") + kind,
+                    [&](size_t i) {
+                            Ray& ray = in.rays[i];
+                            ray.t    = Ray::Infinity;
+                            ray.hit  = NULL;
+                            tri.Intersect(ray);
+                            return ray.hit != NULL;
+                    });
+                run(std::string("  TriAccel::Intersect ") + kind,
+                    [&](size_t i) {
+                            Ray& ray = in.rays[i];
+                            ray.t    = Ray::Infinity;
+                            return acc.Intersect(ray);
+                    });
+                run(std::string("  raw double[3] ") + kind, [&](size_t i) {
+                        in.raw[i].t = Ray::Infinity;
+                        return rawTriangle(v, in.raw[i]);
+                });
+        }
+
+        // Vector<3> operations over pairs of random vectors
+        std::normal_distribution<double> n(0, 1);
+        std::vector<Vector<3>>           a(numInputs), b(numInputs);
+        std::vector<double>              ra(3 * numInputs), rb(3 * numInputs);
+        for (size_t i = 0; i < numInputs; i++) {
+                for (unsigned k = 0; k < 3; k++) {
+                        ra[3 * i + k] = a[i][k] = n(rng);
+                        rb[3 * i + k] = b[i][k] = n(rng);
+                }
+        }
+
+        run("Vector<3>::dot", [&](size_t i) {
+                double d = a[i].dot(b[i]);
+                keep(d);
+                return d > 0;
+        });
+        run("  raw double[3]", [&](size_t i) {
+                double d = rawDot(&ra[3 * i], &rb[3 * i]);
+                keep(d);
+                return d > 0;
+        });
+        run("Vector<3>::cross", [&](size_t i) {
+                Vector<3> c = a[i].cross(b[i]);
+                keep(c);
+                return c.data[0] > 0;
+        });
+        run("  raw double[3]", [&](size_t i) {
+                double c[3];
+                rawCross(&ra[3 * i], &rb[3 * i], c);
+                keep(c);
+                return c[0] > 0;
+        });
+        run("Vector<3>::normalize", [&](size_t i) {
+                Vector<3> c = a[i];
+                c.normalize();
+                keep(c);
+                return c.data[0] > 0;
+        });
+        run("  raw double[3]", [&](size_t i) {
+                double c[3] = {ra[3 * i], ra[3 * i + 1], ra[3 * i + 2]};
+                rawNormalize(c);
+                keep(c);
+                return c[0] > 0;
+        });
+
+        // the same sum through the checked operator[] and the plain array
+        run("Vector<3>::operator[] (checked)", [&](size_t i) {
+                const Vector<3>& c = a[i];
+                double           s = c[0] + c[1] + c[2];
+                keep(s);
+                return s > 0;
+        });
+        run("  Vector<3>::data", [&](size_t i) {
+                const Vector<3>& c = a[i];
+                double           s = c.data[0] + c.data[1] + c.data[2];
+                keep(s);
+                return s > 0;
+        });
+        return 0;
+}
@@ -0,0 +1,202 @@
+//
+// Replays the rays captured during a render (captureRays in the REPL)
+// against an accelerator, and checks the answers against the capture.
+//
+// Usage: replayRays rays.bin scene.ply [more.ply ...] [options]
+//
+//   --threads N   trace with N threads (default 1)
+//   --repeat N    trace every ray N times, report the best run (default 3)
+//   --binned N    build the kd-tree with N bins (default exact SAH)
+//   --perfect     clip straddling triangles when splitting
+//   --brute       test every triangle instead of using the kd-tree
+//   --limit N     only replay the first N rays of the capture
+//
+// The PLY files must be the objects of the captured scene, in the order
+// they were added. Exits with 1 if any ray disagrees with the capture.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "KDTree2.h"
+#include "PolyObject.h"
+#include "RayCapture.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+using namespace RayTracerxx;
+
+/**
+ * @brief      Tests every triangle, the reference any accelerator must match
+ */
+struct BruteForce {
+        std::vector<const Triangle*> tris;
+
+        bool Intersect(Ray& ray) const {
+                for (const Triangle* tri : tris)
+                        tri->Intersect(ray);
+                return ray.hit != NULL;
+        }
+
+        bool Occluded(Ray& ray, Number_t tmax) const {
+                ray.hit = NULL;
+                ray.t   = tmax;
+                for (const Triangle* tri : tris) {
+                        tri->Intersect(ray);
+                        if (ray.hit != NULL)
+                                return true;
+                }
+                return false;
+        }
+};
+
+struct Replay {
+        size_t rays;
+        double seconds;  // best run
+        size_t mismatches;
+};
+
+/**
+ * @brief      Traces the rays of one kind with any accelerator providing
+ *             Intersect(Ray&) and Occluded(Ray&, tmax)
+ */
+template <class Accelerator>
+Replay replay(const Accelerator& accel, const std::vector<CapturedRay>& rays,
+              unsigned repeat) {
+        using namespace std::chrono;
+        std::vector<char>   hits(rays.size());
+        std::vector<double> ts(rays.size());
+        Replay              result = {rays.size(), 0, 0};
+
+        for (unsigned r = 0; r < repeat; r++) {
+                auto start = steady_clock::now();
+                parallelFor(0, rays.size(), 4096, [&](size_t first,
+                                                      size_t last) {
+                        for (size_t i = first; i < last; i++) {
+                                Ray ray = rays[i].toRay();
+                                if (rays[i].kind == CapturedRay::PRIMARY)
+                                        hits[i] = accel.Intersect(ray);
+                                else
+                                        hits[i] =
+                                            accel.Occluded(ray, rays[i].tmax);
+                                ts[i] = ray.t;
+                        }
+                });
+                double seconds =
+                    duration<double>(steady_clock::now() - start).count();
+                if (r == 0 or seconds < result.seconds)
+                        result.seconds = seconds;
+        }
+
+        for (size_t i = 0; i < rays.size(); i++) {
+                const CapturedRay& c  = rays[i];
+                bool               ok = bool(hits[i]) == bool(c.hit);
+                if (ok and c.kind == CapturedRay::PRIMARY and c.hit)
+                        ok = std::fabs(ts[i] - c.t) <=
+                             1e-9 * std::max(1.0, std::fabs(c.t));
+                if (not ok and result.mismatches++ < 5)
+                        std::cerr << "Ray " << i << ": captured hit " << c.hit
+                                  << " t " << c.t << ", replayed hit "
+                                  << int(hits[i]) << " t " << ts[i] << "\n";
+        }
+        return result;
+}
+
+template <class Accelerator>
+size_t report(const Accelerator& accel, const std::vector<CapturedRay>& rays,
+              unsigned repeat) {
+        const char* names[] = {"Primary", "Shadow"};
+        size_t      mismatches = 0;
+
+        for (uint32_t kind : {CapturedRay::PRIMARY, CapturedRay::SHADOW}) {
+                std::vector<CapturedRay> subset;
+                for (const CapturedRay& r : rays)
+                        if (r.kind == kind)
+                                subset.push_back(r);
+                if (subset.empty())
+                        continue;
+
+                Replay r = replay(accel, subset, repeat);
+                std::cout << std::left << std::setw(8) << names[kind]
+                          << std::right << std::setw(10) << r.rays
+                          << " rays " << std::fixed << std::setprecision(3)
+                          << std::setw(9) << r.seconds << " s "
+                          << std::setw(9) << r.rays / r.seconds / 1e6
+                          << " Mrays/s " << r.mismatches << " mismatches\n";
+                mismatches += r.mismatches;
+        }
+        return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+        std::vector<std::string> plys;
+        std::string              capture;
+        unsigned                 threads = 1, repeat = 3;
+        size_t                   limit   = 0;
+        bool                     brute   = false;
+        KDTree::BuildOptions     opts;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--threads" and i + 1 < argc)
+                        threads = std::atoi(argv[++i]);
+                else if (arg == "--repeat" and i + 1 < argc)
+                        repeat = std::max(1, std::atoi(argv[++i]));
+                else if (arg == "--binned" and i + 1 < argc)
+                        opts.bins = std::atoi(argv[++i]);
+                else if (arg == "--perfect")
+                        opts.perfectSplits = true;
+                else if (arg == "--limit" and i + 1 < argc)
+                        limit = std::atol(argv[++i]);
+                else if (arg == "--brute")
+                        brute = true;
+                else if (capture.empty())
+                        capture = arg;
+                else
+                        plys.push_back(arg);
+        }
+        if (plys.empty()) {
+                std::cerr << "Usage: replayRays rays.bin scene.ply [more.ply "
+                             "...] [--threads N] [--repeat N] [--binned N] "
+                             "[--perfect] [--brute] [--limit N]\n";
+                return 2;
+        }
+
+        std::vector<CapturedRay> rays;
+        if (not RayCapture::load(capture, rays)) {
+                std::cerr << "Unable to read ray capture: " << capture << "\n";
+                return 2;
+        }
+        if (limit > 0 and limit < rays.size())
+                rays.resize(limit);
+        std::cout << "Loaded " << rays.size() << " rays\n";
+
+        ThreadPool::instance().start(threads);
+
+        // builds the tree exactly as the REPL does
+        std::vector<PolyObject> objects;
+        Scene                   scene;
+        for (const std::string& ply : plys) {
+                objects.push_back(PolyObject(ply));
+                scene.addObject(objects.back());
+        }
+        scene.setBuildOptions(opts);
+        const KDTree* tree = scene.getTree();
+
+        size_t mismatches;
+        if (brute) {
+                BruteForce accel;
+                for (const PolyObject& object : objects)
+                        for (const Triangle& tri : object.mesh)
+                                accel.tris.push_back(&tri);
+                mismatches = report(accel, rays, repeat);
+        } else
+                mismatches = report(*tree, rays, repeat);
+
+        ThreadPool::instance().stop();
+        return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+//
+// Measures where the parallel build and render stop scaling, run by
+// `make bench-threads`. The kd-tree of one scene is built and the scene is
+// rendered with 1, 2, 4, ... threads up to the number of cores, with the
+// threads left to the scheduler and pinned to one CPU each.
+//
+// Usage: threadScaling scene.ply [options]
+//
+//   --max-threads N     largest pool (default all cores), always measured
+//   --repeat N          runs per measure, the best is kept (default 3)
+//   --size WxH          image size (default 640x360)
+//   --binned N          build the kd-tree with N bins (default exact SAH)
+//   --pin on|off|both   thread placements to measure (default both)
+//   --csv file          also write the measures to file
+//
+// Speedup is relative to one thread with the same placement, efficiency is
+// speedup / threads. Idle time is the time each thread of the pool spent
+// without a task during the best run (ThreadPool::stats). The CSV has one
+// line per thread of every measure:
+//
+//   phase,pinned,threads,seconds,speedup,efficiency,thread,idle_seconds
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BenchLights.h"
+#include "Log.h"
+#include "PolyObject.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+using namespace RayTracerxx;
+
+struct Measure {
+        std::string         phase;
+        bool                pinned;
+        unsigned            threads;
+        double              seconds;  // best run
+        std::vector<double> idle;     // per thread, during the best run
+};
+
+/**
+ * @brief      Runs f repeat times on a fresh pool of the given size, keeps
+ *             the fastest run and the idle time of its threads
+ */
+template <class Function>
+Measure measure(const std::string& phase, unsigned threads, bool pin,
+                unsigned repeat, Function f) {
+        using namespace std::chrono;
+        ThreadPool& pool = ThreadPool::instance();
+        Measure     m    = {phase, pin, threads, 0, {}};
+
+        pool.start(threads, pin);
+        for (unsigned r = 0; r < repeat; r++) {
+                pool.resetStats();
+                auto start = steady_clock::now();
+                f();
+                double seconds =
+                    duration<double>(steady_clock::now() - start).count();
+                if (r > 0 and seconds >= m.seconds)
+                        continue;
+
+                m.seconds = seconds;
+                m.idle.clear();
+                for (const ThreadPool::WorkerStats& s : pool.stats())
+                        m.idle.push_back(std::min(s.idleSeconds, seconds));
+        }
+        return m;
+}
+
+int main(int argc, char* argv[]) {
+        std::string          ply, csv, pin = "both";
+        unsigned             maxThreads = std::thread::hardware_concurrency();
+        unsigned             repeat = 3, width = 640, height = 360;
+        KDTree::BuildOptions opts;
+
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--max-threads" and i + 1 < argc)
+                        maxThreads = std::atoi(argv[++i]);
+                else if (arg == "--repeat" and i + 1 < argc)
+                        repeat = std::max(1, std::atoi(argv[++i]));
+                else if (arg == "--size" and i + 1 < argc)
+                        std::sscanf(argv[++i], "%ux%u", &width, &height);
+                else if (arg == "--binned" and i + 1 < argc)
+                        opts.bins = std::atoi(argv[++i]);
+                else if (arg == "--pin" and i + 1 < argc)
+                        pin = argv[++i];
+                else if (arg == "--csv" and i + 1 < argc)
+                        csv = argv[++i];
+                else
+                        ply = arg;
+        }
+        if (ply.empty() or width == 0 or height == 0 or
+            (pin != "on" and pin != "off" and pin != "both")) {
+                std::cerr << "Usage: threadScaling scene.ply [--max-threads N] "
+                             "[--repeat N] [--size WxH] [--binned N] "
+                             "[--pin on|off|both] [--csv file]\n";
+                return 2;
+        }
+        maxThreads = std::max(1u, maxThreads);
+
+        std::vector<unsigned> counts;
+        for (unsigned n = 1; n < maxThreads; n *= 2)
+                counts.push_back(n);
+        counts.push_back(maxThreads);
+
+        std::vector<bool> placements;
+        if (pin != "on")
+                placements.push_back(false);
+        if (pin != "off")
+                placements.push_back(true);
+
+        Log::setVerbosity(Log::QUIET);
+
+        Scene      scene(width, height);
+        PolyObject object(ply);
+        if (object.mesh.empty()) {
+                std::cerr << "No triangles in " << ply << "\n";
+                return 1;
+        }
+
+        const Box& b = object.bbox;
+        scene.addObject(object);
+        scene.camera.setPosition(
+            (b.hi[0] + b.low[0]) / 2, (b.hi[1] + b.low[1]) / 2,
+            b.hi[2] + 0.6 * std::max(b.hi[0] - b.low[0], b.hi[1] - b.low[1]));
+        for (const BenchLight& light : benchLights) {
+                const int*    p = light.position;
+                const double* c = light.color;
+                scene.addLight({Number_t(p[0]), Number_t(p[1]), Number_t(p[2])},
+                               {c[0], c[1], c[2]});
+        }
+
+        std::vector<Measure> measures;
+        for (bool pinned : placements) {
+                for (unsigned n : counts) {
+                        measures.push_back(
+                            measure("build", n, pinned, repeat, [&] {
+                                    scene.setBuildOptions(opts);  // rebuilds
+                                    scene.getTree();
+                            }));
+                        measures.push_back(measure("render", n, pinned,
+                                                   repeat,
+                                                   [&] { scene.renderScene(); }));
+                }
+        }
+        ThreadPool::instance().stop();
+
+        // one thread with the same placement is the reference
+        auto serial = [&](const Measure& m) {
+                for (const Measure& s : measures)
+                        if (s.phase == m.phase and s.pinned == m.pinned and
+                            s.threads == 1)
+                                return s.seconds;
+                return m.seconds;
+        };
+
+        std::cout << "Scene " << ply << ": " << object.mesh.size()
+                  << " triangles, " << width << "x" << height << ", best of "
+                  << repeat << " runs\n";
+        std::cout << std::left << std::setw(8) << "phase" << std::setw(8)
+                  << "pinned" << std::right << std::setw(8) << "threads"
+                  << std::setw(10) << "seconds" << std::setw(9) << "speedup"
+                  << std::setw(12) << "efficiency" << std::setw(22)
+                  << "idle % min/mean/max\n";
+
+        std::ofstream file;
+        if (not csv.empty()) {
+                file.open(csv.c_str());
+                file << "phase,pinned,threads,seconds,speedup,efficiency,"
+                        "thread,idle_seconds\n";
+        }
+
+        for (const Measure& m : measures) {
+                double speedup    = serial(m) / m.seconds;
+                double efficiency = speedup / m.threads;
+                double sum = 0, least = m.seconds, most = 0;
+                for (double idle : m.idle) {
+                        sum += idle;
+                        least = std::min(least, idle);
+                        most  = std::max(most, idle);
+                }
+                double toPercent = 100 / m.seconds;
+
+                std::cout << std::left << std::setw(8) << m.phase
+                          << std::setw(8) << (m.pinned ? "yes" : "no")
+                          << std::right << std::setw(8) << m.threads
+                          << std::fixed << std::setprecision(3)
+                          << std::setw(10) << m.seconds << std::setprecision(2)
+                          << std::setw(9) << speedup << std::setw(11)
+                          << 100 * efficiency << "%" << std::setprecision(1)
+                          << std::setw(10) << least * toPercent << " /"
+                          << std::setw(5)
+                          << sum / m.idle.size() * toPercent << " /"
+                          << std::setw(5) << most * toPercent << "\n";
+
+                for (size_t t = 0; t < m.idle.size() and file.is_open(); t++)
+                        file << m.phase << "," << m.pinned << "," << m.threads
+                             << "," << m.seconds << "," << speedup << ","
+                             << efficiency << "," << t << "," << m.idle[t]
+                             << "\n";
+        }
+
+        if (file.is_open() and not file) {
+                std::cerr << "Unable to write " << csv << "\n";
+                return 1;
+        }
+        return 0;
+}